@@ -0,0 +1,138 @@
+#include "aggregate.h"
+#include <cstring>
+
+double StatSummary::mean() const
+{
+    if (count == 0) {return 0.0;}
+    return (double)sum / (double)count;
+}
+
+int StatSummary::min() const
+{
+    for (int v = 0; v <= 100; v++)
+    {
+        if (histogram[v] != 0) {return v;}
+    }
+    return 0;
+}
+
+int StatSummary::max() const
+{
+    for (int v = 100; v >= 0; v--)
+    {
+        if (histogram[v] != 0) {return v;}
+    }
+    return 0;
+}
+
+int StatSummary::percentile(double fraction) const
+{
+    if (count == 0) {return 0;}
+    if (fraction < 0) {fraction = 0;}
+    if (fraction > 1) {fraction = 1;}
+
+    //smallest value whose cumulative count reaches the rank
+    uint64_t rank = (uint64_t)(fraction * (double)(count - 1)) + 1;
+    uint64_t seen = 0;
+    for (int v = 0; v <= 100; v++)
+    {
+        seen += histogram[v];
+        if (seen >= rank) {return v;}
+    }
+    return 100;
+}
+
+int StatSummary::median() const
+{
+    return percentile(0.5);
+}
+
+uint64_t StatSummary::below(int threshold) const
+{
+    uint64_t total = 0;
+    for (int v = 0; v < threshold && v <= 100; v++) {total += histogram[v];}
+    return total;
+}
+
+uint64_t StatSummary::above(int threshold) const
+{
+    uint64_t total = 0;
+    for (int v = threshold < 0 ? 0 : threshold + 1; v <= 100; v++) {total += histogram[v];}
+    return total;
+}
+
+//per-chunk partial, 32-bit buckets are plenty for one chunk
+struct Partial
+{
+    uint32_t histogram[STAT_COUNT][101];
+};
+
+static void summarise(span<PasoChan* const> pets, Partial& out)
+{
+    memset(&out, 0, sizeof(out));
+    for (PasoChan* pet : pets)
+    {
+        if (pet == nullptr) {continue;}
+        Stats s = pet->get_stats();
+        out.histogram[HEALTH][s.health]++;
+        out.histogram[HUNGER][s.hunger]++;
+        out.histogram[HAPPINESS][s.happiness]++;
+        out.histogram[STRESS][s.stress]++;
+    }
+}
+
+static void merge(const Partial& partial, FleetStats& into)
+{
+    for (int s = 0; s < STAT_COUNT; s++)
+    {
+        for (int v = 0; v <= 100; v++) {into.stats[s].histogram[v] += partial.histogram[s][v];}
+    }
+}
+
+//counts and sums come from the merged histograms
+static void finish(FleetStats& fleet)
+{
+    for (int s = 0; s < STAT_COUNT; s++)
+    {
+        StatSummary& summary = fleet.stats[s];
+        summary.count = 0;
+        summary.sum = 0;
+        for (int v = 0; v <= 100; v++)
+        {
+            summary.count += summary.histogram[v];
+            summary.sum += summary.histogram[v] * (uint64_t)v;
+        }
+    }
+    fleet.pets = fleet.stats[HEALTH].count;
+}
+
+FleetStats aggregate(const PetPool& pool, WorkerPool& workers)
+{
+    FleetStats fleet;
+    memset(&fleet, 0, sizeof(fleet));
+
+    vector<Partial> partials(pool.chunk_count());
+    workers.parallel_for(partials.size(), [&](size_t chunk)
+    {
+        summarise(pool.chunk(chunk), partials[chunk]);
+    });
+
+    for (const Partial& partial : partials) {merge(partial, fleet);}
+    finish(fleet);
+    return fleet;
+}
+
+FleetStats aggregate(span<PasoChan* const> pets)
+{
+    FleetStats fleet;
+    memset(&fleet, 0, sizeof(fleet));
+
+    Partial partial;
+    for (size_t begin = 0; begin < pets.size(); begin += PetPool::CHUNK_SIZE)
+    {
+        summarise(pets.subspan(begin, min(PetPool::CHUNK_SIZE, pets.size() - begin)), partial);
+        merge(partial, fleet);
+    }
+    finish(fleet);
+    return fleet;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "pasochan.h"
+#include "pool.h"
+#include "workers.h"
+
+//distribution of one stat across the fleet, everything is derived from the
+//101-bucket histogram so merging partial results is just adding buckets
+struct StatSummary
+{
+    uint64_t histogram[101];
+    uint64_t count;
+    uint64_t sum;
+
+    double mean() const;
+    int min() const;
+    int max() const;
+    //value at or below which the given fraction (0..1) of pets fall
+    int percentile(double fraction) const;
+    int median() const;
+    uint64_t below(int threshold) const;
+    uint64_t above(int threshold) const;
+};
+
+struct FleetStats
+{
+    uint64_t pets;
+    StatSummary stats[STAT_COUNT];
+};
+
+//one pass over the pool, chunks are summarised in parallel and then merged
+FleetStats aggregate(const PetPool& pool, WorkerPool& workers);
+//single threaded form for a plain list of pets (nullptr entries skipped)
+FleetStats aggregate(span<PasoChan* const> pets);
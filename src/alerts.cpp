@@ -0,0 +1,55 @@
+#include "alerts.h"
+#include <mutex>
+
+AlertMonitor::AlertMonitor()
+{
+    enabled_mask = 0;
+    next_handler = 0;
+}
+
+void AlertMonitor::set_threshold(StatId stat, AlertDirection direction, int level, int hysteresis)
+{
+    if (stat >= STAT_COUNT) {return;}
+    thresholds[stat].enabled = true;
+    thresholds[stat].direction = direction;
+    thresholds[stat].level = level;
+    thresholds[stat].hysteresis = hysteresis < 0 ? 0 : hysteresis;
+    enabled_mask |= (uint8_t)(1 << stat);
+}
+
+void AlertMonitor::clear_threshold(StatId stat)
+{
+    if (stat >= STAT_COUNT) {return;}
+    thresholds[stat].enabled = false;
+    enabled_mask &= (uint8_t)~(1 << stat);
+}
+
+size_t AlertMonitor::subscribe(AlertHandler handler)
+{
+    unique_lock<shared_mutex> guard(handlers_lock);
+    size_t handle = next_handler++;
+    handlers.emplace_back(handle, std::move(handler));
+    return handle;
+}
+
+void AlertMonitor::unsubscribe(size_t handle)
+{
+    unique_lock<shared_mutex> guard(handlers_lock);
+    for (auto it = handlers.begin(); it != handlers.end(); ++it)
+    {
+        if (it->first == handle)
+        {
+            handlers.erase(it);
+            return;
+        }
+    }
+}
+
+void AlertMonitor::publish(const AlertEvent& event)
+{
+    shared_lock<shared_mutex> guard(handlers_lock);
+    for (const auto& handler : handlers)
+    {
+        handler.second(event);
+    }
+}
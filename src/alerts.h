@@ -0,0 +1,88 @@
+#pragma once
+#include <functional>
+#include <shared_mutex>
+#include "clock.h"
+#include "pasochan.h"
+
+enum AlertDirection : uint8_t
+{
+    BELOW,
+    ABOVE
+};
+
+struct AlertEvent
+{
+    PetId pet;
+    StatId stat;
+    bool raised;        //false when the stat has recovered past the hysteresis band
+    int value;
+    SimTime time;
+};
+
+typedef function<void(const AlertEvent&)> AlertHandler;
+
+//per-stat alert thresholds checked by PasoChan::apply right after the clamp.
+//A stat raises its alert once when it crosses the level and only clears
+//after moving back hysteresis points past it, so a stat hovering around
+//the level does not flap. Handlers run on the mutating thread.
+class AlertMonitor
+{
+private:
+    struct Threshold
+    {
+        bool enabled = false;
+        AlertDirection direction = BELOW;
+        int level = 0;
+        int hysteresis = 0;
+    };
+
+    //set up before pets are attached, read without locking afterwards
+    Threshold thresholds[STAT_COUNT];
+    uint8_t enabled_mask;
+
+    mutable shared_mutex handlers_lock;
+    vector<pair<size_t, AlertHandler>> handlers;
+    size_t next_handler;
+
+    void publish(const AlertEvent& event);
+
+public:
+    AlertMonitor();
+
+    //BELOW raises when the stat drops under level and clears at level + hysteresis,
+    //ABOVE raises when it goes over level and clears at level - hysteresis
+    void set_threshold(StatId stat, AlertDirection direction, int level, int hysteresis = 0);
+    void clear_threshold(StatId stat);
+
+    size_t subscribe(AlertHandler handler);
+    void unsubscribe(size_t handle);
+
+    //called with the pet's stats after a mutation and its latch bits
+    void check(PetId pet, const Stats& after, atomic<uint8_t>& latch)
+    {
+        if (enabled_mask == 0) {return;}
+        int values[STAT_COUNT] = {after.health, after.hunger, after.happiness, after.stress};
+        uint8_t latched = latch.load(memory_order_relaxed);
+
+        for (int s = 0; s < STAT_COUNT; s++)
+        {
+            const Threshold& t = thresholds[s];
+            if (!t.enabled) {continue;}
+
+            uint8_t bit = (uint8_t)(1 << s);
+            int v = values[s];
+            bool past = t.direction == BELOW ? v < t.level : v > t.level;
+            bool recovered = t.direction == BELOW ? v >= t.level + t.hysteresis : v <= t.level - t.hysteresis;
+
+            //only the thread that flips the latch publishes
+            if (past && !(latched & bit))
+            {
+                if (!(latch.fetch_or(bit) & bit)) {publish(AlertEvent{pet, (StatId)s, true, v, sim_now()});}
+            }
+            else if (recovered && (latched & bit))
+            {
+                if (latch.fetch_and((uint8_t)~bit) & bit) {publish(AlertEvent{pet, (StatId)s, false, v, sim_now()});}
+            }
+        }
+    }
+};
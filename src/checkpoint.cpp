@@ -0,0 +1,523 @@
+#include "checkpoint.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <unistd.h>
+#include <unordered_map>
+#include "checksum.h"
+#include "codec.h"
+
+static const char MAGIC[8] = {'P', 'A', 'S', 'O', 'C', 'K', 'P', 'T'};
+static const uint32_t VERSION = 1;
+
+//a checkpoint file on its way to disk
+struct Checkpointer::FileWrite
+{
+    int fd;
+    bool base;
+    uint64_t seq;
+    string tmp;
+    string path;
+    atomic<size_t> pending;     //chunk writes not yet complete, plus one for the encoder
+    atomic<bool> ok;
+};
+
+struct ChainFile
+{
+    uint64_t seq;
+    bool base;
+    string path;
+};
+
+static string file_name(const string& dir, bool base, uint64_t seq)
+{
+    return dir + "/" + (base ? "base-" : "delta-") + to_string(seq) + ".ckpt";
+}
+
+//checkpoint files in the directory, oldest first
+static vector<ChainFile> list_files(const string& dir)
+{
+    vector<ChainFile> files;
+    error_code error;
+    for (const filesystem::directory_entry& entry : filesystem::directory_iterator(dir, error))
+    {
+        string name = entry.path().filename().string();
+        if (name.size() < 6 || name.substr(name.size() - 5) != ".ckpt") {continue;}
+
+        bool base = name.rfind("base-", 0) == 0;
+        if (!base && name.rfind("delta-", 0) != 0) {continue;}
+        uint64_t seq = strtoull(name.c_str() + (base ? 5 : 6), nullptr, 10);
+        files.push_back(ChainFile{seq, base, entry.path().string()});
+    }
+    sort(files.begin(), files.end(), [](const ChainFile& a, const ChainFile& b) {return a.seq < b.seq;});
+    return files;
+}
+
+//the newest base and every delta written after it
+static vector<ChainFile> newest_chain(const string& dir)
+{
+    vector<ChainFile> files = list_files(dir);
+    size_t start = files.size();
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        if (files[i].base) {start = i;}
+    }
+    if (start == files.size()) {return vector<ChainFile>();}
+    return vector<ChainFile>(files.begin() + start, files.end());
+}
+
+static bool sync_dir(const string& dir)
+{
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {return false;}
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+static bool write_all(int fd, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0)
+        {
+            if (errno == EINTR) {continue;}
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+//renames a synced file into place and syncs the directory so the rename
+//survives a crash. Only then is the old chain, which a new base replaces,
+//removed.
+static bool install_file(const string& dir, const string& tmp, const string& path, bool base, uint64_t seq)
+{
+    if (rename(tmp.c_str(), path.c_str()) != 0 || !sync_dir(dir)) {return false;}
+    if (base)
+    {
+        for (const ChainFile& old : list_files(dir))
+        {
+            if (old.seq < seq) {remove(old.path.c_str());}
+        }
+    }
+    return true;
+}
+
+//header, removed ids, length-prefixed records, CRC-32C trailer, handed to
+//emit in pieces of about a megabyte. emit may take the contents of the
+//piece it is given.
+static void encode_checkpoint(bool base, uint64_t seq, uint64_t base_seq, const vector<PetId>& removed, size_t count,
+                              const function<void(size_t, string&)>& encode, const function<void(string&)>& emit)
+{
+    string buffer(MAGIC, sizeof(MAGIC));
+    put_u32(buffer, VERSION);
+    put_u8(buffer, base ? 1 : 0);
+    put_u64(buffer, seq);
+    put_u64(buffer, base_seq);
+    put_u32(buffer, PetSchema::fingerprint());
+    put_u64(buffer, removed.size());
+    for (PetId id : removed) {put_u64(buffer, id);}
+    put_u64(buffer, count);
+
+    uint32_t crc = 0;
+    string record;
+    for (size_t i = 0; i < count; i++)
+    {
+        record.clear();
+        encode(i, record);
+        put_u32(buffer, (uint32_t)record.size());
+        buffer.append(record);
+
+        if (buffer.size() >= (1 << 20))
+        {
+            crc = crc32c(buffer.data(), buffer.size(), crc);
+            emit(buffer);
+            buffer.clear();
+        }
+    }
+    crc = crc32c(buffer.data(), buffer.size(), crc);
+    put_u32(buffer, crc);
+    emit(buffer);
+}
+
+//encodes a checkpoint straight to path + ".tmp", syncs it and installs it
+//in dir
+static bool write_checkpoint(const string& dir, const string& path, bool base, uint64_t seq, uint64_t base_seq,
+                             const vector<PetId>& removed, size_t count, const function<void(size_t, string&)>& encode)
+{
+    string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        cout << "Could not open " << tmp << " for writing" << endl;
+        return false;
+    }
+
+    bool ok = true;
+    encode_checkpoint(base, seq, base_seq, removed, count, encode, [&](string& piece)
+    {
+        if (ok && !write_all(fd, piece.data(), piece.size())) {ok = false;}
+    });
+    ok = fdatasync(fd) == 0 && ok;
+    ok = ::close(fd) == 0 && ok;
+
+    if (!ok || !install_file(dir, tmp, path, base, seq))
+    {
+        cout << "Could not write checkpoint " << path << endl;
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+//reads one file of a chain into data and checks its header and checksum,
+//leaving view on what follows the header
+static bool read_checkpoint(const ChainFile& file, uint64_t base_seq, string& data, string_view& view)
+{
+    ifstream in(file.path, ios::binary);
+    if (!in)
+    {
+        cout << "Could not open checkpoint " << file.path << endl;
+        return false;
+    }
+    stringstream contents;
+    contents << in.rdbuf();
+    data = contents.str();
+
+    view = string_view(data);
+    string_view magic;
+    uint32_t version;
+    uint8_t base;
+    uint64_t seq;
+    uint64_t parent;
+    uint32_t schema;
+    if (view.size() < 4 || !get_bytes(view, sizeof(MAGIC), magic) || magic != string_view(MAGIC, sizeof(MAGIC))
+        || !get_u32(view, version) || version != VERSION
+        || !get_u8(view, base) || !get_u64(view, seq) || !get_u64(view, parent)
+        || !get_u32(view, schema) || schema != PetSchema::fingerprint())
+    {
+        cout << "Checkpoint " << file.path << " has a bad header" << endl;
+        return false;
+    }
+    if (parent != base_seq || (base != 0) != file.base)
+    {
+        cout << "Checkpoint " << file.path << " does not belong to base " << base_seq << endl;
+        return false;
+    }
+
+    string_view trailer = string_view(data).substr(data.size() - 4);
+    uint32_t stored_crc = 0;
+    get_u32(trailer, stored_crc);
+    if (crc32c(data.data(), data.size() - 4) != stored_crc)
+    {
+        cout << "Checkpoint " << file.path << " failed its checksum" << endl;
+        return false;
+    }
+    return true;
+}
+
+//applies one file of a chain to pets, removals before records
+static bool apply_checkpoint(const ChainFile& file, uint64_t base_seq, unordered_map<PetId, PetRecord>& pets)
+{
+    string data;
+    string_view view;
+    if (!read_checkpoint(file, base_seq, data, view)) {return false;}
+
+    uint64_t removed;
+    if (!get_u64(view, removed)) {return false;}
+    for (uint64_t i = 0; i < removed; i++)
+    {
+        PetId id;
+        if (!get_u64(view, id)) {return false;}
+        pets.erase(id);
+    }
+
+    uint64_t count;
+    if (!get_u64(view, count)) {return false;}
+    for (uint64_t i = 0; i < count; i++)
+    {
+        uint32_t size;
+        string_view bytes;
+        PetRecord record;
+        if (!get_u32(view, size) || !get_bytes(view, size, bytes) || !decode_record(bytes, record))
+        {
+            cout << "Checkpoint " << file.path << " has a bad record" << endl;
+            return false;
+        }
+        pets[record.id] = std::move(record);
+    }
+    return true;
+}
+
+//replays the newest chain, stopping at the first damaged delta so the
+//result is always a state that existed. complete is false if any delta
+//was left out.
+static bool load_chain(const string& dir, unordered_map<PetId, PetRecord>& pets, uint64_t& last_seq, bool& complete)
+{
+    complete = false;
+    vector<ChainFile> chain = newest_chain(dir);
+    if (chain.empty())
+    {
+        cout << "No checkpoint base in " << dir << endl;
+        return false;
+    }
+    if (!apply_checkpoint(chain[0], chain[0].seq, pets)) {return false;}
+    last_seq = chain[0].seq;
+
+    for (size_t i = 1; i < chain.size(); i++)
+    {
+        if (!apply_checkpoint(chain[i], chain[0].seq, pets)) {return true;}
+        last_seq = chain[i].seq;
+    }
+    complete = true;
+    return true;
+}
+
+Checkpointer::Checkpointer(PetPool& pool, const string& directory, const TimerWheel* timers, size_t max_chain)
+    : pool(pool), timers(timers), dir(directory)
+{
+    next_seq = 1;
+    base_seq = 0;
+    chain_length = 0;
+    this->max_chain = max_chain;
+    last_pets = 0;
+    writing = false;
+    failed = false;
+}
+
+Checkpointer::~Checkpointer()
+{
+    settle();
+}
+
+bool Checkpointer::open()
+{
+    error_code error;
+    filesystem::create_directories(dir, error);
+    if (error)
+    {
+        cout << "Could not create checkpoint directory " << dir << endl;
+        return false;
+    }
+
+    vector<ChainFile> files = list_files(dir);
+    if (!files.empty()) {next_seq = files.back().seq + 1;}
+
+    vector<ChainFile> chain = newest_chain(dir);
+    if (chain.empty()) {return true;}
+
+    //recovery stops at a damaged file, so deltas written after one would
+    //never be read. Such a chain gets a fresh base first.
+    string data;
+    string_view view;
+    for (const ChainFile& file : chain)
+    {
+        if (!read_checkpoint(file, chain[0].seq, data, view))
+        {
+            cout << "Checkpoint chain in " << dir << " is damaged, the next checkpoint is a base" << endl;
+            return true;
+        }
+    }
+
+    base_seq = chain[0].seq;
+    chain_length = chain.size() - 1;
+    pool.take_dirty();
+    pool.take_removed();
+    return true;
+}
+
+//encodes the file on this thread, each piece going to io as soon as it is
+//ready; the file is synced and renamed into place by whichever completion
+//finishes last
+bool Checkpointer::write_file(bool base, const vector<PetSlot>& slots, const vector<PetId>& removed)
+{
+    uint64_t seq = next_seq;
+    auto file = make_shared<FileWrite>();
+    file->base = base;
+    file->seq = seq;
+    file->path = file_name(dir, base, seq);
+    file->tmp = file->path + ".tmp";
+    file->pending = 1;
+    file->ok = true;
+    file->fd = ::open(file->tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file->fd < 0)
+    {
+        cout << "Could not open " << file->tmp << " for writing" << endl;
+        return false;
+    }
+    {
+        lock_guard<mutex> guard(write_lock);
+        writing = true;
+        failed = false;
+    }
+
+    uint64_t offset = 0;
+    encode_checkpoint(base, seq, base ? seq : base_seq, removed, slots.size(), [&](size_t i, string& out)
+    {
+        const PasoChan* pet = pool.get(slots[i]);
+        encode_record(capture_pet(pet->get_id(), *pet, timers), out);
+    },
+    [&](string& piece)
+    {
+        auto data = make_shared<const string>(std::move(piece));
+        piece.clear();
+        file->pending++;
+        io.write(file->fd, offset, data, [this, file](bool ok) {finish_chunk(file, ok);});
+        offset += data->size();
+    });
+    finish_chunk(file, true);
+
+    next_seq++;
+    last_pets = slots.size();
+    return true;
+}
+
+void Checkpointer::finish_chunk(const shared_ptr<FileWrite>& file, bool ok)
+{
+    if (!ok) {file->ok = false;}
+    if (--file->pending > 0) {return;}
+    io.sync(file->fd, [this, file](bool synced) {publish(file, synced);});
+}
+
+//runs on the I/O thread once the file is complete and synced, or failed
+void Checkpointer::publish(const shared_ptr<FileWrite>& file, bool synced)
+{
+    bool ok = synced && file->ok;
+    ::close(file->fd);
+    if (!ok || !install_file(dir, file->tmp, file->path, file->base, file->seq))
+    {
+        cout << "Could not write checkpoint " << file->path << endl;
+        remove(file->tmp.c_str());
+        ok = false;
+    }
+
+    {
+        lock_guard<mutex> guard(write_lock);
+        writing = false;
+        failed = !ok;
+    }
+    written.notify_all();
+}
+
+bool Checkpointer::settle()
+{
+    unique_lock<mutex> guard(write_lock);
+    written.wait(guard, [&] {return !writing;});
+    return !failed;
+}
+
+bool Checkpointer::write_base()
+{
+    settle();
+    pool.take_dirty();
+    vector<PetId> removed = pool.take_removed();
+
+    vector<PetSlot> slots;
+    slots.reserve(pool.size());
+    for (PetSlot slot = 0; slot < pool.slot_count(); slot++)
+    {
+        if (pool.get(slot) != nullptr) {slots.push_back(slot);}
+    }
+
+    uint64_t seq = next_seq;
+    if (!write_file(true, slots, vector<PetId>()))
+    {
+        //nothing was lost, the next checkpoint covers it all again
+        pool.mark_all_dirty();
+        unsaved_removals.insert(unsaved_removals.end(), removed.begin(), removed.end());
+        return false;
+    }
+    base_seq = seq;
+    chain_length = 0;
+    unsaved_removals.clear();
+    return true;
+}
+
+bool Checkpointer::write_delta()
+{
+    //a failed file leaves changes that no delta would carry
+    if (!settle() || base_seq == 0) {return write_base();}
+
+    vector<PetSlot> slots = pool.take_dirty();
+    vector<PetId> removed = pool.take_removed();
+    removed.insert(removed.begin(), unsaved_removals.begin(), unsaved_removals.end());
+
+    if (!write_file(false, slots, removed))
+    {
+        for (PetSlot slot : slots) {pool.mark_dirty(slot);}
+        unsaved_removals = removed;
+        return false;
+    }
+    chain_length++;
+    unsaved_removals.clear();
+    return true;
+}
+
+bool Checkpointer::checkpoint()
+{
+    if (!settle() || base_seq == 0 || chain_length >= max_chain) {return write_base();}
+    return write_delta();
+}
+
+size_t Checkpointer::last_written() const
+{
+    return last_pets;
+}
+
+bool recover_checkpoints(const string& directory, PetRegistry& registry, TimerWheel* timers, const PetHooks* hooks,
+                         pmr::memory_resource* resource, pmr::memory_resource* owners_resource)
+{
+    unordered_map<PetId, PetRecord> pets;
+    uint64_t last_seq;
+    bool complete;
+    if (!load_chain(directory, pets, last_seq, complete)) {return false;}
+
+    registry.reserve(registry.size() + pets.size());
+    for (const auto& entry : pets)
+    {
+        const PetRecord& record = entry.second;
+        PetHandle pet = restore_pet(record, resource, owners_resource);
+        if (!pet || !registry.insert(record.id, pet)) {continue;}
+        pet->attach(record.id, hooks);
+        if (timers != nullptr) {restore_timers(record, *timers);}
+    }
+    return true;
+}
+
+bool merge_checkpoints(const string& directory)
+{
+    unordered_map<PetId, PetRecord> pets;
+    uint64_t last_seq;
+    bool complete;
+    if (!load_chain(directory, pets, last_seq, complete)) {return false;}
+    //the files past a damaged delta hold changes the merge could not read
+    if (!complete)
+    {
+        cout << "Checkpoint chain in " << directory << " is damaged, not merging it" << endl;
+        return false;
+    }
+
+    vector<const PetRecord*> records;
+    records.reserve(pets.size());
+    for (const auto& entry : pets) {records.push_back(&entry.second);}
+
+    vector<ChainFile> files = list_files(directory);
+    uint64_t seq = files.back().seq + 1;
+    //the new base replaces every file listed, which install_file removes
+    //once the base is durable
+    return write_checkpoint(directory, file_name(directory, true, seq), true, seq, seq, vector<PetId>(), records.size(),
+                            [&](size_t i, string& out)
+    {
+        encode_record(*records[i], out);
+    });
+}
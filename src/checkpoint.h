@@ -0,0 +1,90 @@
+#pragma once
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "ioqueue.h"
+#include "pool.h"
+#include "registry.h"
+#include "snapshot.h"
+#include "timers.h"
+
+//incremental persistence of a pool. A base file holds every pet; each
+//delta after it holds only the pets the pool saw change (or added) since
+//the previous checkpoint, plus the ids of pets removed from it, so a
+//checkpoint costs I/O in proportion to what changed. Recovery loads the
+//newest base and replays its deltas in order. Files are named
+//base-<seq>.ckpt and delta-<seq>.ckpt, sequence numbers never repeat.
+//
+//Timer changes alone do not dirty a pet; pending timers are saved along
+//with a pet whenever its record is written.
+//
+//The calling thread only encodes a checkpoint. Writing it, syncing it and
+//renaming it into place happen through an IoQueue; one file is in flight
+//at a time so the chain on disk never has gaps. A file that fails to get
+//to disk makes the next checkpoint a base.
+class Checkpointer
+{
+private:
+    struct FileWrite;
+
+    PetPool& pool;
+    const TimerWheel* timers;
+    string dir;
+    uint64_t next_seq;
+    uint64_t base_seq;          //0 until a base exists
+    size_t chain_length;
+    size_t max_chain;
+    size_t last_pets;
+    vector<PetId> unsaved_removals;
+
+    mutex write_lock;
+    condition_variable written;
+    bool writing;               //a file is in flight
+    bool failed;                //the last file did not make it to disk
+    IoQueue io;                 //last, so it drains before the rest goes away
+
+    bool write_file(bool base, const vector<PetSlot>& slots, const vector<PetId>& removed);
+    void finish_chunk(const shared_ptr<FileWrite>& file, bool ok);
+    void publish(const shared_ptr<FileWrite>& file, bool ok);
+
+public:
+    //a new base is written once max_chain deltas hang off the current one
+    Checkpointer(PetPool& pool, const string& directory, const TimerWheel* timers = nullptr, size_t max_chain = 16);
+    ~Checkpointer();
+
+    Checkpointer(const Checkpointer&) = delete;
+    Checkpointer& operator=(const Checkpointer&) = delete;
+
+    //picks up the newest chain in the directory. If there is one, the pets
+    //already in the pool are taken to be the ones recovered from it, and
+    //their dirty bits are cleared. If any file in it is damaged, the next
+    //checkpoint is a base instead, since recovery stops at that file.
+    bool open();
+
+    //a delta, or a base if there is none yet, the chain is long enough or
+    //the previous file failed. Returns once the file is encoded and queued,
+    //waiting first for the previous one; false if it could not be started.
+    bool checkpoint();
+    bool write_base();
+    bool write_delta();
+
+    //waits for the file in flight, false if it did not make it to disk
+    bool settle();
+
+    //pets written by the last checkpoint
+    size_t last_written() const;
+};
+
+//rebuilds the pets of the newest chain in directory into registry, see
+//load_snapshot() for the other arguments
+bool recover_checkpoints(const string& directory, PetRegistry& registry, TimerWheel* timers, const PetHooks* hooks,
+                         pmr::memory_resource* resource = pmr::get_default_resource(),
+                         pmr::memory_resource* owners_resource = nullptr);
+
+//offline tool: folds the newest chain into a single base and deletes every
+//older file once the base is synced and its rename is durable. Nothing may
+//be checkpointing into directory meanwhile. Fails and deletes nothing if
+//the chain has a damaged file.
+bool merge_checkpoints(const string& directory);
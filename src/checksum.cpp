@@ -0,0 +1,277 @@
+#include "checksum.h"
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+//reflected Castagnoli polynomial
+static const uint32_t POLY = 0x82f63b78;
+
+//slicing-by-8: entries[k][b] is the crc of byte b followed by k zero bytes
+struct Crc32cTable
+{
+    uint32_t entries[8][256];
+
+    Crc32cTable()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc & 1) ? (crc >> 1) ^ POLY : crc >> 1;
+            }
+            entries[0][i] = crc;
+        }
+        for (int k = 1; k < 8; k++)
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t crc = entries[k - 1][i];
+                entries[k][i] = entries[0][crc & 0xff] ^ (crc >> 8);
+            }
+        }
+    }
+};
+
+static const Crc32cTable table;
+
+//the functions below work on the raw register, without the inversions
+static uint32_t update_portable(uint32_t crc, const uint8_t* bytes, size_t size)
+{
+    while (size > 0 && ((uintptr_t)bytes & 7) != 0)
+    {
+        crc = table.entries[0][(crc ^ *bytes++) & 0xff] ^ (crc >> 8);
+        size--;
+    }
+    while (size >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        word ^= crc;
+        crc = table.entries[7][word & 0xff] ^ table.entries[6][(word >> 8) & 0xff]
+            ^ table.entries[5][(word >> 16) & 0xff] ^ table.entries[4][(word >> 24) & 0xff]
+            ^ table.entries[3][(word >> 32) & 0xff] ^ table.entries[2][(word >> 40) & 0xff]
+            ^ table.entries[1][(word >> 48) & 0xff] ^ table.entries[0][word >> 56];
+        bytes += 8;
+        size -= 8;
+    }
+    while (size > 0)
+    {
+        crc = table.entries[0][(crc ^ *bytes++) & 0xff] ^ (crc >> 8);
+        size--;
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+
+//the crc32 instruction has a latency of 3 cycles but issues every cycle,
+//so big inputs are split into three streams that run side by side and are
+//then stitched together with a carry-less multiply
+static const size_t LONG_STREAM = 4096;
+static const size_t SHORT_STREAM = 256;
+
+//x^n mod P in the reflected bit order, where bit 31 is x^0
+static uint32_t xpow_mod(uint64_t n)
+{
+    uint32_t result = 0x80000000;
+    uint32_t square = 0x40000000;       //x^1
+    while (n != 0)
+    {
+        if (n & 1)
+        {
+            //result *= square, one bit of square at a time
+            uint32_t product = 0;
+            uint32_t a = result;
+            for (int i = 0; i < 32; i++)
+            {
+                if (square & (0x80000000u >> i)) {product ^= a;}
+                a = (a & 1) ? (a >> 1) ^ POLY : a >> 1;
+            }
+            result = product;
+        }
+        uint32_t product = 0;
+        uint32_t a = square;
+        for (int i = 0; i < 32; i++)
+        {
+            if (square & (0x80000000u >> i)) {product ^= a;}
+            a = (a & 1) ? (a >> 1) ^ POLY : a >> 1;
+        }
+        square = product;
+        n >>= 1;
+    }
+    return result;
+}
+
+//multiplier that moves a register past size zero bytes: crc32 of the
+//64-bit carry-less product makes up the other 33 powers of x
+static uint64_t shift_constant(size_t size)
+{
+    return xpow_mod(8 * size - 33);
+}
+
+struct ShiftConstants
+{
+    uint64_t long_shift;
+    uint64_t short_shift;
+
+    ShiftConstants()
+    {
+        long_shift = shift_constant(LONG_STREAM);
+        short_shift = shift_constant(SHORT_STREAM);
+    }
+};
+
+static const ShiftConstants shifts;
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t shift_crc(uint32_t crc, uint64_t constant)
+{
+    __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc), _mm_cvtsi64_si128((long long)constant), 0);
+    return (uint32_t)_mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(product));
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t run_streams(uint32_t crc, const uint8_t*& bytes, size_t& size, size_t stream, uint64_t constant)
+{
+    while (size >= 3 * stream)
+    {
+        uint64_t c0 = crc;
+        uint64_t c1 = 0;
+        uint64_t c2 = 0;
+        const uint8_t* end = bytes + stream;
+        while (bytes < end)
+        {
+            uint64_t w0;
+            uint64_t w1;
+            uint64_t w2;
+            memcpy(&w0, bytes, 8);
+            memcpy(&w1, bytes + stream, 8);
+            memcpy(&w2, bytes + 2 * stream, 8);
+            c0 = _mm_crc32_u64(c0, w0);
+            c1 = _mm_crc32_u64(c1, w1);
+            c2 = _mm_crc32_u64(c2, w2);
+            bytes += 8;
+        }
+        crc = shift_crc((uint32_t)c0, constant) ^ (uint32_t)c1;
+        crc = shift_crc(crc, constant) ^ (uint32_t)c2;
+        bytes += 2 * stream;
+        size -= 3 * stream;
+    }
+    return crc;
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t update_sse42_pclmul(uint32_t crc, const uint8_t* bytes, size_t size)
+{
+    while (size > 0 && ((uintptr_t)bytes & 7) != 0)
+    {
+        crc = _mm_crc32_u8(crc, *bytes++);
+        size--;
+    }
+    crc = run_streams(crc, bytes, size, LONG_STREAM, shifts.long_shift);
+    crc = run_streams(crc, bytes, size, SHORT_STREAM, shifts.short_shift);
+
+    uint64_t wide = crc;
+    while (size >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        wide = _mm_crc32_u64(wide, word);
+        bytes += 8;
+        size -= 8;
+    }
+    crc = (uint32_t)wide;
+    while (size > 0)
+    {
+        crc = _mm_crc32_u8(crc, *bytes++);
+        size--;
+    }
+    return crc;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t update_sse42(uint32_t crc, const uint8_t* bytes, size_t size)
+{
+    uint64_t wide = crc;
+    while (size >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        wide = _mm_crc32_u64(wide, word);
+        bytes += 8;
+        size -= 8;
+    }
+    crc = (uint32_t)wide;
+    while (size > 0)
+    {
+        crc = _mm_crc32_u8(crc, *bytes++);
+        size--;
+    }
+    return crc;
+}
+
+#endif
+
+typedef uint32_t (*Crc32cFn)(uint32_t, const uint8_t*, size_t);
+
+struct Crc32cImpl
+{
+    Crc32cFn fn;
+    const char* name;
+
+    //picked once at startup from what the CPU supports
+    Crc32cImpl()
+    {
+        fn = update_portable;
+        name = "portable";
+#if defined(__x86_64__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul"))
+        {
+            fn = update_sse42_pclmul;
+            name = "sse4.2+pclmul";
+        }
+        else if (__builtin_cpu_supports("sse4.2"))
+        {
+            fn = update_sse42;
+            name = "sse4.2";
+        }
+#endif
+    }
+};
+
+static const Crc32cImpl impl;
+
+uint32_t crc32c(const void* data, size_t size, uint32_t crc)
+{
+    return ~impl.fn(~crc, (const uint8_t*)data, size);
+}
+
+uint32_t crc32c_portable(const void* data, size_t size, uint32_t crc)
+{
+    return ~update_portable(~crc, (const uint8_t*)data, size);
+}
+
+const char* crc32c_implementation()
+{
+    return impl.name;
+}
+
+void seal_frame(string& frame)
+{
+    uint32_t crc = crc32c(frame.data(), frame.size());
+    for (int i = 0; i < 4; i++) {frame.push_back((char)(crc >> (8 * i)));}
+}
+
+bool open_frame(string_view& frame)
+{
+    if (frame.size() < 4) {return false;}
+    size_t body = frame.size() - 4;
+    uint32_t stored = 0;
+    for (int i = 0; i < 4; i++) {stored |= (uint32_t)(uint8_t)frame[body + i] << (8 * i);}
+    if (crc32c(frame.data(), body) != stored) {return false;}
+    frame.remove_suffix(4);
+    return true;
+}
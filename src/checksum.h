@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+using namespace std;
+
+//CRC-32C (Castagnoli) as used by every on-disk format in the project.
+//Pass the previous result as crc to checksum data in pieces. Uses the
+//SSE4.2 crc32 instruction (with PCLMUL to run three streams at once) when
+//the CPU has it, picked once at startup, and a table driven version
+//otherwise.
+uint32_t crc32c(const void* data, size_t size, uint32_t crc = 0);
+
+//the table driven version, always available, gives the same results
+uint32_t crc32c_portable(const void* data, size_t size, uint32_t crc = 0);
+
+//which version crc32c() is using, e.g. for logging at startup
+const char* crc32c_implementation();
+
+//appends the CRC-32C of frame as a little-endian u32, for messages sent
+//to relays and peers
+void seal_frame(string& frame);
+//checks and strips the trailer added by seal_frame(), false if it is
+//missing or does not match
+bool open_frame(string_view& frame);
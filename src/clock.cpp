@@ -0,0 +1,20 @@
+#include "clock.h"
+#include <atomic>
+using namespace std;
+
+static atomic<SimTime> current{0};
+
+SimTime sim_now()
+{
+    return current.load(memory_order_relaxed);
+}
+
+void sim_set(SimTime now)
+{
+    current.store(now, memory_order_relaxed);
+}
+
+SimTime sim_advance(SimTime elapsed)
+{
+    return current.fetch_add(elapsed, memory_order_relaxed) + elapsed;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <cstdint>
+
+//simulated time in milliseconds. It only moves when the tick engine (or a
+//replay) advances it, so everything stamped with it is reproducible.
+typedef uint64_t SimTime;
+
+SimTime sim_now();
+void sim_set(SimTime now);
+SimTime sim_advance(SimTime elapsed);
@@ -0,0 +1,101 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+using namespace std;
+
+//little-endian helpers shared by the persistence formats. The get_*
+//functions consume from the front of in and return false when it runs out.
+
+inline void put_u8(string& out, uint8_t v)
+{
+    out.push_back((char)v);
+}
+
+inline void put_u16(string& out, uint16_t v)
+{
+    char b[2] = {(char)v, (char)(v >> 8)};
+    out.append(b, 2);
+}
+
+inline void put_u32(string& out, uint32_t v)
+{
+    char b[4];
+    for (int i = 0; i < 4; i++) {b[i] = (char)(v >> (8 * i));}
+    out.append(b, 4);
+}
+
+inline void put_u64(string& out, uint64_t v)
+{
+    char b[8];
+    for (int i = 0; i < 8; i++) {b[i] = (char)(v >> (8 * i));}
+    out.append(b, 8);
+}
+
+//LEB128, 7 bits per byte
+inline void put_varint(string& out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+inline bool get_u8(string_view& in, uint8_t& v)
+{
+    if (in.size() < 1) {return false;}
+    v = (uint8_t)in[0];
+    in.remove_prefix(1);
+    return true;
+}
+
+inline bool get_u16(string_view& in, uint16_t& v)
+{
+    if (in.size() < 2) {return false;}
+    v = (uint16_t)((uint8_t)in[0] | (uint8_t)in[1] << 8);
+    in.remove_prefix(2);
+    return true;
+}
+
+inline bool get_u32(string_view& in, uint32_t& v)
+{
+    if (in.size() < 4) {return false;}
+    v = 0;
+    for (int i = 0; i < 4; i++) {v |= (uint32_t)(uint8_t)in[i] << (8 * i);}
+    in.remove_prefix(4);
+    return true;
+}
+
+inline bool get_u64(string_view& in, uint64_t& v)
+{
+    if (in.size() < 8) {return false;}
+    v = 0;
+    for (int i = 0; i < 8; i++) {v |= (uint64_t)(uint8_t)in[i] << (8 * i);}
+    in.remove_prefix(8);
+    return true;
+}
+
+inline bool get_varint(string_view& in, uint64_t& v)
+{
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (in.empty()) {return false;}
+        uint8_t b = (uint8_t)in[0];
+        in.remove_prefix(1);
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {return true;}
+    }
+    return false;
+}
+
+inline bool get_bytes(string_view& in, size_t size, string_view& v)
+{
+    if (in.size() < size) {return false;}
+    v = in.substr(0, size);
+    in.remove_prefix(size);
+    return true;
+}
@@ -0,0 +1,269 @@
+#include "columns.h"
+#include <sstream>
+
+ColumnStore::ColumnStore()
+{
+    slots = 0;
+}
+
+static int width_for(int range)
+{
+    if (range <= 0xff) {return 8;}
+    if (range <= 0xffff) {return 16;}
+    return 32;
+}
+
+ColumnId ColumnStore::register_stat(const ColumnSpec& spec)
+{
+    if (spec.name.empty())
+    {
+        cout << "A stat needs a name" << endl;
+        return NO_COLUMN;
+    }
+    if (by_name.count(spec.name) != 0)
+    {
+        cout << "Stat " << spec.name << " is already registered" << endl;
+        return NO_COLUMN;
+    }
+    if (spec.min > spec.max || spec.init < spec.min || spec.init > spec.max)
+    {
+        cout << "Stat " << spec.name << " has invalid bounds" << endl;
+        return NO_COLUMN;
+    }
+
+    int needed = width_for(spec.max - spec.min);
+    int width = spec.width == 0 ? needed : spec.width;
+    if ((width != 8 && width != 16 && width != 32) || width < needed)
+    {
+        cout << "Stat " << spec.name << " does not fit in " << spec.width << " bits" << endl;
+        return NO_COLUMN;
+    }
+    if (columns.size() >= NO_COLUMN)
+    {
+        cout << "Too many stats registered" << endl;
+        return NO_COLUMN;
+    }
+
+    Column column;
+    column.spec = spec;
+    column.spec.width = width;
+    column.data.resize(slots * (width / 8));
+    columns.push_back(std::move(column));
+
+    ColumnId id = (ColumnId)(columns.size() - 1);
+    by_name[spec.name] = id;
+
+    switch (width)
+    {
+        case 8: fill<uint8_t>(columns[id], 0, slots); break;
+        case 16: fill<uint16_t>(columns[id], 0, slots); break;
+        default: fill<uint32_t>(columns[id], 0, slots); break;
+    }
+    return id;
+}
+
+size_t ColumnStore::register_stats(istream& in)
+{
+    size_t failed = 0;
+    string line;
+    while (getline(in, line))
+    {
+        size_t comment = line.find('#');
+        if (comment != string::npos) {line.resize(comment);}
+        if (line.find_first_not_of(" \t\r") == string::npos) {continue;}
+
+        istringstream fields(line);
+        ColumnSpec spec;
+        if (!(fields >> spec.name >> spec.min >> spec.max >> spec.init))
+        {
+            cout << "Could not parse stat: " << line << endl;
+            failed++;
+            continue;
+        }
+        fields >> spec.decay;
+        if (register_stat(spec) == NO_COLUMN) {failed++;}
+    }
+    return failed;
+}
+
+ColumnId ColumnStore::find(string_view name) const
+{
+    auto it = by_name.find(string(name));
+    if (it == by_name.end()) {return NO_COLUMN;}
+    return it->second;
+}
+
+const ColumnSpec& ColumnStore::spec(ColumnId column) const
+{
+    return columns[column].spec;
+}
+
+size_t ColumnStore::column_count() const
+{
+    return columns.size();
+}
+
+template <typename T>
+void ColumnStore::fill(Column& column, size_t begin, size_t end)
+{
+    T* values = (T*)column.data.data();
+    T init = (T)(column.spec.init - column.spec.min);
+    for (size_t i = begin; i < end; i++) {values[i] = init;}
+}
+
+//stored values are offsets from min, so clamping is to [0, max - min]
+template <typename T>
+void ColumnStore::add_range(Column& column, size_t begin, size_t end, int delta)
+{
+    T* values = (T*)column.data.data();
+    int64_t top = (int64_t)column.spec.max - column.spec.min;
+    for (size_t i = begin; i < end; i++)
+    {
+        int64_t v = (int64_t)values[i] + delta;
+        v = v < 0 ? 0 : (v > top ? top : v);
+        values[i] = (T)v;
+    }
+}
+
+template <typename T>
+uint64_t ColumnStore::count_below_in(const Column& column, int threshold, span<PasoChan* const> live)
+{
+    const T* values = (const T*)column.data.data();
+    int64_t limit = (int64_t)threshold - column.spec.min;
+    uint64_t count = 0;
+    for (size_t i = 0; i < live.size(); i++)
+    {
+        count += (live[i] != nullptr) & ((int64_t)values[i] < limit);
+    }
+    return count;
+}
+
+template <typename T>
+int64_t ColumnStore::sum_in(const Column& column, span<PasoChan* const> live)
+{
+    const T* values = (const T*)column.data.data();
+    int64_t total = 0;
+    uint64_t pets = 0;
+    for (size_t i = 0; i < live.size(); i++)
+    {
+        bool present = live[i] != nullptr;
+        total += present ? (int64_t)values[i] : 0;
+        pets += present;
+    }
+    return total + (int64_t)pets * column.spec.min;
+}
+
+void ColumnStore::resize(size_t slot_count)
+{
+    if (slot_count <= slots) {return;}
+    for (Column& column : columns)
+    {
+        column.data.resize(slot_count * (column.spec.width / 8));
+        switch (column.spec.width)
+        {
+            case 8: fill<uint8_t>(column, slots, slot_count); break;
+            case 16: fill<uint16_t>(column, slots, slot_count); break;
+            default: fill<uint32_t>(column, slots, slot_count); break;
+        }
+    }
+    slots = slot_count;
+}
+
+void ColumnStore::reset(PetSlot slot)
+{
+    if (slot >= slots) {resize(slot + 1);}
+    for (Column& column : columns)
+    {
+        switch (column.spec.width)
+        {
+            case 8: fill<uint8_t>(column, slot, slot + 1); break;
+            case 16: fill<uint16_t>(column, slot, slot + 1); break;
+            default: fill<uint32_t>(column, slot, slot + 1); break;
+        }
+    }
+}
+
+int ColumnStore::get(ColumnId column, PetSlot slot) const
+{
+    const Column& c = columns[column];
+    if (slot >= slots) {return c.spec.init;}
+    switch (c.spec.width)
+    {
+        case 8: return (int)((const uint8_t*)c.data.data())[slot] + c.spec.min;
+        case 16: return (int)((const uint16_t*)c.data.data())[slot] + c.spec.min;
+        default: return (int)((const uint32_t*)c.data.data())[slot] + c.spec.min;
+    }
+}
+
+int ColumnStore::set(ColumnId column, PetSlot slot, int value)
+{
+    if (slot >= slots) {resize(slot + 1);}
+    Column& c = columns[column];
+    value = value < c.spec.min ? c.spec.min : (value > c.spec.max ? c.spec.max : value);
+    uint32_t stored = (uint32_t)(value - c.spec.min);
+    switch (c.spec.width)
+    {
+        case 8: ((uint8_t*)c.data.data())[slot] = (uint8_t)stored; break;
+        case 16: ((uint16_t*)c.data.data())[slot] = (uint16_t)stored; break;
+        default: ((uint32_t*)c.data.data())[slot] = stored; break;
+    }
+    return value;
+}
+
+int ColumnStore::add(ColumnId column, PetSlot slot, int delta)
+{
+    if (slot >= slots) {resize(slot + 1);}
+    Column& c = columns[column];
+    switch (c.spec.width)
+    {
+        case 8: add_range<uint8_t>(c, slot, slot + 1, delta); break;
+        case 16: add_range<uint16_t>(c, slot, slot + 1, delta); break;
+        default: add_range<uint32_t>(c, slot, slot + 1, delta); break;
+    }
+    return get(column, slot);
+}
+
+void ColumnStore::add_all(ColumnId column, int delta, size_t begin, size_t end)
+{
+    end = min(end, slots);
+    if (begin >= end || delta == 0) {return;}
+    Column& c = columns[column];
+    switch (c.spec.width)
+    {
+        case 8: add_range<uint8_t>(c, begin, end, delta); break;
+        case 16: add_range<uint16_t>(c, begin, end, delta); break;
+        default: add_range<uint32_t>(c, begin, end, delta); break;
+    }
+}
+
+void ColumnStore::run_decay(size_t begin, size_t end)
+{
+    for (ColumnId id = 0; id < columns.size(); id++)
+    {
+        add_all(id, columns[id].spec.decay, begin, end);
+    }
+}
+
+uint64_t ColumnStore::count_below(ColumnId column, int threshold, const PetPool& pool) const
+{
+    const Column& c = columns[column];
+    span<PasoChan* const> live = pool.all().first(min(pool.slot_count(), slots));
+    switch (c.spec.width)
+    {
+        case 8: return count_below_in<uint8_t>(c, threshold, live);
+        case 16: return count_below_in<uint16_t>(c, threshold, live);
+        default: return count_below_in<uint32_t>(c, threshold, live);
+    }
+}
+
+int64_t ColumnStore::sum(ColumnId column, const PetPool& pool) const
+{
+    const Column& c = columns[column];
+    span<PasoChan* const> live = pool.all().first(min(pool.slot_count(), slots));
+    switch (c.spec.width)
+    {
+        case 8: return sum_in<uint8_t>(c, live);
+        case 16: return sum_in<uint16_t>(c, live);
+        default: return sum_in<uint32_t>(c, live);
+    }
+}
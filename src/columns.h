@@ -0,0 +1,80 @@
+#pragma once
+#include <unordered_map>
+#include "pasochan.h"
+#include "pool.h"
+
+typedef uint16_t ColumnId;
+
+//a stat added at runtime, e.g. {"energy", 0, 100, 80}. width is the storage
+//width in bits (8, 16 or 32), 0 picks the narrowest that fits max - min.
+struct ColumnSpec
+{
+    string name;
+    int min = 0;
+    int max = 100;
+    int init = 0;
+    int width = 0;
+    //change applied every tick by run_decay
+    int decay = 0;
+};
+
+//extra stats registered at runtime, each stored as its own contiguous
+//column indexed by pool slot, so a new mechanic needs no recompile and does
+//not widen PasoChan. Values are stored as (value - min) in the column's
+//width. Kernels dispatch on the width once per call, not per pet.
+//Columns are plain memory: written by the tick (one chunk per worker) or
+//between ticks, like the pool itself.
+//
+//Columns are transient. They are keyed by pool slot, not by pet, so
+//snapshots, checkpoints, the PetStore and the input log do not carry
+//them. Changes to them do not mark a pet dirty either. After a restart or
+//a replay every column starts over at its init value.
+class ColumnStore
+{
+private:
+    struct Column
+    {
+        ColumnSpec spec;
+        vector<uint8_t> data;
+    };
+
+    vector<Column> columns;
+    unordered_map<string, ColumnId> by_name;
+    size_t slots;
+
+    template <typename T> static void fill(Column& column, size_t begin, size_t end);
+    template <typename T> static void add_range(Column& column, size_t begin, size_t end, int delta);
+    template <typename T> static uint64_t count_below_in(const Column& column, int threshold, span<PasoChan* const> live);
+    template <typename T> static int64_t sum_in(const Column& column, span<PasoChan* const> live);
+
+public:
+    static const ColumnId NO_COLUMN = ~ColumnId(0);
+
+    ColumnStore();
+
+    //returns NO_COLUMN (and prints why) if the name is taken or the spec is invalid
+    ColumnId register_stat(const ColumnSpec& spec);
+    //lines of "<name> <min> <max> <init> [decay]", returns how many failed
+    size_t register_stats(istream& in);
+
+    ColumnId find(string_view name) const;
+    const ColumnSpec& spec(ColumnId column) const;
+    size_t column_count() const;
+
+    //kept in step with the pool's slots, see PetPool::attach_columns
+    void resize(size_t slot_count);
+    //puts a reused slot back to every column's starting value
+    void reset(PetSlot slot);
+
+    int get(ColumnId column, PetSlot slot) const;
+    int set(ColumnId column, PetSlot slot, int value);
+    int add(ColumnId column, PetSlot slot, int delta);
+
+    //batch kernels over slots [begin, end)
+    void add_all(ColumnId column, int delta, size_t begin = 0, size_t end = SIZE_MAX);
+    void run_decay(size_t begin, size_t end);
+
+    //queries only count slots that hold a pet in the pool
+    uint64_t count_below(ColumnId column, int threshold, const PetPool& pool) const;
+    int64_t sum(ColumnId column, const PetPool& pool) const;
+};
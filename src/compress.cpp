@@ -0,0 +1,296 @@
+#include "compress.h"
+#include <algorithm>
+#include <vector>
+#include "checksum.h"
+#include "codec.h"
+
+static const size_t MIN_MATCH = 4;
+//matches never start in the last bytes of a block so the search can read
+//whole words without checking the end
+static const size_t END_LITERALS = 8;
+static const int HASH_BITS = 14;
+static const uint32_t NO_POSITION = UINT32_MAX;
+//room past the end of a decoded block for copies 16 bytes at a time
+static const size_t DECODE_SLACK = 16;
+
+enum BlockResult : uint8_t { BLOCK_DECODED, STREAM_END, NEED_MORE, DAMAGED };
+
+static inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t read64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint32_t hash4(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void put_length(string& out, size_t extra)
+{
+    while (extra >= 255)
+    {
+        out.push_back((char)255);
+        extra -= 255;
+    }
+    out.push_back((char)extra);
+}
+
+//a match of 0 ends the block with literals only
+static void put_sequence(string& out, const uint8_t* literals, size_t literal_count, size_t offset, size_t match)
+{
+    size_t match_code = match >= MIN_MATCH ? match - MIN_MATCH : 0;
+    out.push_back((char)(min(literal_count, (size_t)15) << 4 | min(match_code, (size_t)15)));
+    if (literal_count >= 15) {put_length(out, literal_count - 15);}
+    out.append((const char*)literals, literal_count);
+    if (match == 0) {return;}
+
+    put_u16(out, (uint16_t)offset);
+    if (match_code >= 15) {put_length(out, match_code - 15);}
+}
+
+//greedy matching against the last position each 4-byte hash was seen at,
+//skipping ahead faster the longer nothing matches so incompressible data
+//goes through quickly
+static void compress_block(const uint8_t* src, size_t size, uint32_t* table, string& out)
+{
+    fill(table, table + (1 << HASH_BITS), NO_POSITION);
+    size_t anchor = 0;
+    size_t pos = 0;
+    size_t misses = 0;
+    size_t limit = size > END_LITERALS + MIN_MATCH ? size - END_LITERALS : 0;
+    while (pos < limit)
+    {
+        uint32_t v = read32(src + pos);
+        uint32_t h = hash4(v);
+        size_t candidate = table[h];
+        table[h] = (uint32_t)pos;
+        if (candidate == NO_POSITION || pos - candidate > UINT16_MAX || read32(src + candidate) != v)
+        {
+            pos += 1 + (misses++ >> 6);
+            continue;
+        }
+        misses = 0;
+
+        while (pos > anchor && candidate > 0 && src[pos - 1] == src[candidate - 1])
+        {
+            pos--;
+            candidate--;
+        }
+        size_t match = MIN_MATCH;
+        while (pos + match + 8 <= size)
+        {
+            uint64_t diff = read64(src + pos + match) ^ read64(src + candidate + match);
+            if (diff != 0)
+            {
+                match += __builtin_ctzll(diff) >> 3;
+                break;
+            }
+            match += 8;
+        }
+        if (pos + match + 8 > size)
+        {
+            while (pos + match < size && src[pos + match] == src[candidate + match]) {match++;}
+        }
+
+        put_sequence(out, src + anchor, pos - anchor, pos - candidate, match);
+        pos += match;
+        anchor = pos;
+        if (pos + 2 <= size) {table[hash4(read32(src + pos - 2))] = (uint32_t)(pos - 2);}
+    }
+    put_sequence(out, src + anchor, size - anchor, 0, 0);
+}
+
+static bool get_length(const uint8_t*& in, const uint8_t* end, size_t& length)
+{
+    uint8_t b;
+    do
+    {
+        if (in == end) {return false;}
+        b = *in++;
+        length += b;
+    } while (b == 255);
+    return true;
+}
+
+//dst has room for DECODE_SLACK bytes past raw
+static bool expand_block(const uint8_t* in, size_t packed, uint8_t* dst, size_t raw)
+{
+    const uint8_t* in_end = in + packed;
+    uint8_t* op = dst;
+    uint8_t* op_end = dst + raw;
+    while (true)
+    {
+        if (in == in_end) {return false;}
+        uint8_t token = *in++;
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !get_length(in, in_end, literals)) {return false;}
+        if ((size_t)(in_end - in) < literals || (size_t)(op_end - op) < literals) {return false;}
+        //short runs, the common case, are copied with one fixed size copy
+        if (literals <= 16 && in_end - in >= 16) {memcpy(op, in, 16);}
+        else {memcpy(op, in, literals);}
+        op += literals;
+        in += literals;
+        if (in == in_end) {break;}
+
+        if (in_end - in < 2) {return false;}
+        size_t offset = in[0] | in[1] << 8;
+        in += 2;
+        size_t match = (token & 15) + MIN_MATCH;
+        if ((token & 15) == 15 && !get_length(in, in_end, match)) {return false;}
+        if (offset == 0 || offset > (size_t)(op - dst) || (size_t)(op_end - op) < match) {return false;}
+
+        //a far enough match is copied 16 bytes at a time, overshooting into
+        //the slack. A close one repeats a short pattern: its first bytes go
+        //one at a time, then the copies read from a whole number of
+        //patterns back, at least 16 bytes, so no read overlaps a store
+        //still in flight
+        const uint8_t* from = op - offset;
+        size_t i = 0;
+        if (offset < 16)
+        {
+            for (; i < match && i < 16; i++) {op[i] = from[i];}
+            from = op - offset * ((16 + offset - 1) / offset);
+        }
+        for (; i < match; i += 16) {memcpy(op + i, from + i, 16);}
+        op += match;
+    }
+    return op == op_end;
+}
+
+//decodes the block at the front of in, leaving in alone if it is not all there
+static BlockResult next_block(string_view& in, string& out)
+{
+    string_view view = in;
+    uint64_t raw;
+    uint64_t packed;
+    if (!get_varint(view, raw)) {return in.size() >= 10 ? DAMAGED : NEED_MORE;}
+    if (raw == 0)
+    {
+        in = view;
+        return STREAM_END;
+    }
+    if (raw > BLOCK_SIZE) {return DAMAGED;}
+    if (!get_varint(view, packed)) {return in.size() >= 20 ? DAMAGED : NEED_MORE;}
+    if (packed >= raw) {return DAMAGED;}
+
+    string_view body;
+    if (!get_bytes(view, packed == 0 ? raw : packed, body)) {return NEED_MORE;}
+
+    if (packed == 0) {out.append(body);}
+    else
+    {
+        size_t start = out.size();
+        out.resize(start + raw + DECODE_SLACK);
+        bool ok = expand_block((const uint8_t*)body.data(), body.size(), (uint8_t*)&out[start], raw);
+        out.resize(ok ? start + raw : start);
+        if (!ok) {return DAMAGED;}
+    }
+    in = view;
+    return BLOCK_DECODED;
+}
+
+void compress(string_view in, string& out)
+{
+    vector<uint32_t> table(1 << HASH_BITS);
+    string packed;
+    for (size_t start = 0; start < in.size(); start += BLOCK_SIZE)
+    {
+        size_t raw = min(BLOCK_SIZE, in.size() - start);
+        packed.clear();
+        compress_block((const uint8_t*)in.data() + start, raw, table.data(), packed);
+
+        put_varint(out, raw);
+        if (packed.size() < raw)
+        {
+            put_varint(out, packed.size());
+            out.append(packed);
+        }
+        else
+        {
+            put_varint(out, 0);
+            out.append(in.substr(start, raw));
+        }
+    }
+    put_varint(out, 0);
+}
+
+bool decompress(string_view in, string& out)
+{
+    while (true)
+    {
+        BlockResult result = next_block(in, out);
+        if (result == STREAM_END) {return in.empty();}
+        if (result != BLOCK_DECODED) {return false;}
+    }
+}
+
+Decompressor::Decompressor()
+{
+    finished = false;
+    failed = false;
+}
+
+bool Decompressor::feed(string_view data, string& out)
+{
+    if (failed) {return false;}
+    if (finished)
+    {
+        failed = !data.empty();
+        return !failed;
+    }
+
+    pending.append(data);
+    string_view view(pending);
+    while (true)
+    {
+        BlockResult result = next_block(view, out);
+        if (result == BLOCK_DECODED) {continue;}
+
+        if (result == STREAM_END)
+        {
+            finished = true;
+            failed = !view.empty();
+        }
+        failed = failed || result == DAMAGED;
+        break;
+    }
+    pending.erase(0, pending.size() - view.size());
+    return !failed;
+}
+
+bool Decompressor::done() const
+{
+    return finished && !failed;
+}
+
+void encode_frame(string_view payload, bool compressed, string& frame)
+{
+    frame.clear();
+    put_u8(frame, compressed ? 1 : 0);
+    if (compressed) {compress(payload, frame);}
+    else {frame.append(payload);}
+    seal_frame(frame);
+}
+
+bool decode_frame(string_view frame, string& payload)
+{
+    uint8_t compressed;
+    payload.clear();
+    if (!open_frame(frame) || !get_u8(frame, compressed) || compressed > 1) {return false;}
+    if (compressed == 0)
+    {
+        payload.assign(frame);
+        return true;
+    }
+    return decompress(frame, payload);
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+using namespace std;
+
+//LZ77 style compression for persisted and relayed pet data, which is full
+//of repeats (owner indexes, timer kinds, stats sitting at the same values).
+//Input is cut into blocks of up to BLOCK_SIZE bytes that are compressed
+//independently, each stored as is when it would not shrink:
+//  varint raw size (0 ends the stream), varint packed size (0 if stored), bytes
+//Within a block a sequence is a token (literal count:4, match length - 4:4,
+//15 meaning more length bytes follow), the literals, then a u16 offset
+//back into the block and the extra match length bytes. The last sequence
+//of a block has literals only.
+static const size_t BLOCK_SIZE = 64 << 10;
+
+//appends the compressed stream for in to out
+void compress(string_view in, string& out);
+
+//appends the decompressed contents of a whole stream to out, false if it
+//is damaged or incomplete
+bool decompress(string_view in, string& out);
+
+//decodes a stream that arrives in pieces, a block at a time, holding on
+//to at most one partial block
+class Decompressor
+{
+private:
+    string pending;
+    bool finished;
+    bool failed;
+
+public:
+    Decompressor();
+
+    //appends whatever can be decoded so far to out, false once the stream
+    //turns out to be damaged
+    bool feed(string_view data, string& out);
+
+    //true after the end of the stream has been seen
+    bool done() const;
+};
+
+//batch frames for relays: a flag byte saying whether the payload is
+//compressed, the payload, and a CRC-32C trailer (see seal_frame())
+void encode_frame(string_view payload, bool compressed, string& frame);
+bool decode_frame(string_view frame, string& payload);
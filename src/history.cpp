@@ -0,0 +1,112 @@
+#include "history.h"
+
+StatHistory::StatHistory()
+{
+    newest = 0;
+    head = 0;
+    count = 0;
+    lock.clear();
+}
+
+StatHistory::StatHistory(const StatHistory& other)
+{
+    lock.clear();
+    SpinGuard guard(other.lock);
+    for (int i = 0; i < SIZE; i++) {entries[i] = other.entries[i];}
+    newest = other.newest;
+    head = other.head;
+    count = other.count;
+}
+
+HistoryEntry StatHistory::decode(uint32_t entry, SimTime time)
+{
+    return HistoryEntry{time, (uint8_t)(entry >> 7 & 0x3), (int)(entry & 0x7f)};
+}
+
+void StatHistory::record(SimTime now, uint8_t stat, int value)
+{
+    record(now, &stat, &value, 1);
+}
+
+void StatHistory::record(SimTime now, const uint8_t* stats, const int* values, int n)
+{
+    SpinGuard guard(lock);
+    for (int i = 0; i < n; i++)
+    {
+        SimTime delta = count == 0 || now < newest ? 0 : now - newest;
+        if (delta > MAX_DELTA) {delta = MAX_DELTA;}
+
+        entries[head] = (uint32_t)delta << 9 | (uint32_t)(stats[i] & 0x3) << 7 | (uint32_t)(values[i] & 0x7f);
+        head = (uint8_t)((head + 1) % SIZE);
+        if (count < SIZE) {count++;}
+        if (now > newest) {newest = now;}
+    }
+}
+
+void StatHistory::clear()
+{
+    SpinGuard guard(lock);
+    head = 0;
+    count = 0;
+    newest = 0;
+}
+
+StatHistory::View StatHistory::view() const
+{
+    return View(this);
+}
+
+StatHistory::View::View(const StatHistory* history)
+{
+    SpinGuard guard(history->lock);
+    for (int i = 0; i < SIZE; i++) {entries[i] = history->entries[i];}
+    newest = history->newest;
+    head = history->head;
+    count = history->count;
+}
+
+StatHistory::Iterator StatHistory::View::begin() const
+{
+    return Iterator(this, count);
+}
+
+StatHistory::Iterator StatHistory::View::end() const
+{
+    return Iterator(this, 0);
+}
+
+size_t StatHistory::View::size() const
+{
+    return count;
+}
+
+StatHistory::Iterator::Iterator(const View* view, int remaining) : view(view), remaining(remaining)
+{
+    index = (view->head + SIZE - 1) % SIZE;
+    time = view->newest;
+}
+
+HistoryEntry StatHistory::Iterator::operator*() const
+{
+    return decode(view->entries[index], time);
+}
+
+StatHistory::Iterator& StatHistory::Iterator::operator++()
+{
+    //this entry's delta leads back to the one before it
+    SimTime delta = view->entries[index] >> 9;
+    time = delta > time ? 0 : time - delta;
+    index = (index + SIZE - 1) % SIZE;
+    remaining--;
+    return *this;
+}
+
+bool StatHistory::Iterator::operator==(const Iterator& other) const
+{
+    return remaining == other.remaining;
+}
+
+bool StatHistory::Iterator::operator!=(const Iterator& other) const
+{
+    return remaining != other.remaining;
+}
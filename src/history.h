@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include "clock.h"
+#include "spinlock.h"
+
+struct HistoryEntry
+{
+    SimTime time;
+    uint8_t stat;       //a StatId
+    int value;
+};
+
+//fixed-size ring of a pet's most recent stat changes. Each change is one
+//32-bit word: milliseconds since the previous change (23 bits, saturating
+//at about 2.3 hours), the stat (2 bits) and its new value (7 bits). Only
+//the newest change's full timestamp is kept; older ones are rebuilt by
+//walking the deltas backwards.
+class StatHistory
+{
+public:
+    static const int SIZE = 16;
+
+private:
+    static const uint32_t DELTA_BITS = 23;
+    static const uint32_t MAX_DELTA = (1u << DELTA_BITS) - 1;
+
+    uint32_t entries[SIZE];
+    SimTime newest;
+    uint8_t head;           //next slot to write
+    uint8_t count;
+    mutable atomic_flag lock;
+
+    static HistoryEntry decode(uint32_t entry, SimTime time);
+
+public:
+    class View;
+
+    //walks a View newest to oldest, decoding as it goes
+    class Iterator
+    {
+    private:
+        const View* view;
+        int remaining;
+        int index;
+        SimTime time;
+
+    public:
+        typedef forward_iterator_tag iterator_category;
+        typedef HistoryEntry value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const HistoryEntry* pointer;
+        typedef HistoryEntry reference;
+
+        Iterator(const View* view, int remaining);
+
+        HistoryEntry operator*() const;
+        Iterator& operator++();
+        bool operator==(const Iterator& other) const;
+        bool operator!=(const Iterator& other) const;
+    };
+
+    //copy of the ring taken under the lock, so readers can keep it as long
+    //as they like without holding up writers. It is not a zero-copy view
+    //of the pet's ring: that is overwritten in place by record(), so each
+    //view() copies the SIZE packed words (about 80 bytes) and only the
+    //decoding is deferred to the Iterator.
+    class View
+    {
+    private:
+        friend class Iterator;
+
+        uint32_t entries[SIZE];
+        SimTime newest;
+        uint8_t head;
+        uint8_t count;
+
+    public:
+        explicit View(const StatHistory* history);
+
+        Iterator begin() const;
+        Iterator end() const;
+        size_t size() const;
+    };
+
+    StatHistory();
+    //the ring is copied, the lock is not
+    StatHistory(const StatHistory& other);
+    StatHistory& operator=(const StatHistory&) = delete;
+
+    void record(SimTime now, uint8_t stat, int value);
+    //several changes made at the same instant, under one lock
+    void record(SimTime now, const uint8_t* stats, const int* values, int n);
+    void clear();
+
+    View view() const;
+};
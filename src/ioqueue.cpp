@@ -0,0 +1,358 @@
+#include "ioqueue.h"
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+//largest single write handed to the kernel, longer ones go in pieces
+static const size_t MAX_WRITE = 1 << 30;
+
+static int uring_setup(unsigned entries, io_uring_params* params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned wait, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, nullptr, 0);
+}
+
+//the submission and completion rings shared with the kernel. Only one
+//thread at a time fills in submissions (under the queue's lock) and only
+//the completer thread consumes completions.
+struct IoQueue::Ring
+{
+    int fd = -1;
+    void* sq_ptr = MAP_FAILED;
+    size_t sq_size = 0;
+    void* cq_ptr = MAP_FAILED;
+    size_t cq_size = 0;
+    io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+    size_t sqes_size = 0;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe* cqes;
+
+    ~Ring()
+    {
+        if (sqes != MAP_FAILED) {munmap(sqes, sqes_size);}
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) {munmap(cq_ptr, cq_size);}
+        if (sq_ptr != MAP_FAILED) {munmap(sq_ptr, sq_size);}
+        if (fd >= 0) {close(fd);}
+    }
+
+    bool open(unsigned depth)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = uring_setup(depth, &params);
+        if (fd < 0) {return false;}
+        //kernels before 5.6 have no IORING_OP_WRITE
+        if ((params.features & IORING_FEAT_RW_CUR_POS) == 0) {return false;}
+
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) {sq_size = cq_size = max(sq_size, cq_size);}
+
+        sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) {return false;}
+        cq_ptr = single ? sq_ptr
+                        : mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {return false;}
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                   IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {return false;}
+
+        char* sq = (char*)sq_ptr;
+        char* cq = (char*)cq_ptr;
+        sq_head = (unsigned*)(sq + params.sq_off.head);
+        sq_tail = (unsigned*)(sq + params.sq_off.tail);
+        sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq + params.sq_off.array);
+        cq_head = (unsigned*)(cq + params.cq_off.head);
+        cq_tail = (unsigned*)(cq + params.cq_off.tail);
+        cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        return true;
+    }
+};
+
+IoQueue::IoQueue(bool use_uring, unsigned depth)
+{
+    in_flight = 0;
+    capacity = depth;
+    stopping = false;
+    if (use_uring)
+    {
+        ring = make_unique<Ring>();
+        if (!ring->open(depth)) {ring = nullptr;}
+    }
+    if (ring) {completer = thread(&IoQueue::ring_loop, this);}
+    else {completer = thread(&IoQueue::fallback_loop, this);}
+}
+
+IoQueue::~IoQueue()
+{
+    drain();
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+        if (ring)
+        {
+            //a ring that refuses the wake-up is failing the completer's
+            //waits as well, which notices stopping on its own
+            Op* wake = new Op{WAKE, -1, 0, nullptr, 0, false, nullptr};
+            if (push(wake) != 0) {delete wake;}
+        }
+    }
+    work_ready.notify_all();
+    completer.join();
+}
+
+bool IoQueue::uring() const
+{
+    return ring != nullptr;
+}
+
+void IoQueue::write(int fd, uint64_t offset, shared_ptr<const string> data, Completion done)
+{
+    submit(new Op{WRITE, fd, offset, std::move(data), 0, false, std::move(done)});
+}
+
+void IoQueue::sync(int fd, Completion done)
+{
+    submit(new Op{SYNC, fd, 0, nullptr, 0, true, std::move(done)});
+}
+
+void IoQueue::write_sync(int fd, uint64_t offset, shared_ptr<const string> data, Completion done)
+{
+    submit(new Op{WRITE_SYNC, fd, offset, std::move(data), 0, false, std::move(done)});
+}
+
+void IoQueue::drain()
+{
+    unique_lock<mutex> guard(lock);
+    idle.wait(guard, [&] {return in_flight == 0 && deferred.empty();});
+}
+
+void IoQueue::submit(Op* op)
+{
+    unique_lock<mutex> guard(lock);
+    //completions may submit follow-up work and must never wait for space,
+    //since only they can make it. Theirs waits in deferred instead, and is
+    //pushed as ops complete.
+    if (this_thread::get_id() == completer.get_id())
+    {
+        if (in_flight >= capacity)
+        {
+            deferred.push_back(op);
+            return;
+        }
+    }
+    else {space.wait(guard, [&] {return in_flight < capacity;});}
+    in_flight++;
+    push_or_fail(op, guard);
+}
+
+//push() for an op that is counted in in_flight, completing it as failed
+//if it could not be handed over. Completions only run on the completer,
+//since callers submit while holding locks their completions take.
+void IoQueue::push_or_fail(Op* op, unique_lock<mutex>& guard)
+{
+    int result = push(op);
+    if (result == 0) {return;}
+
+    if (this_thread::get_id() == completer.get_id())
+    {
+        guard.unlock();
+        complete(op, result);
+        guard.lock();
+        return;
+    }
+
+    //a no-op wakes the completer to fail it; if the ring refuses that as
+    //well, the completer's own waits are failing and it comes round anyway
+    refused.emplace_back(op, result);
+    Op* nudge = new Op{NUDGE, -1, 0, nullptr, 0, false, nullptr};
+    if (push(nudge) != 0) {delete nudge;}
+}
+
+//hands the next step of op to the kernel or the fallback thread, with lock
+//held. Returns 0, or -errno if the kernel refused it, in which case op
+//is not in the ring.
+int IoQueue::push(Op* op)
+{
+    if (!ring)
+    {
+        work.push_back(op);
+        work_ready.notify_one();
+        return 0;
+    }
+
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & ring->sq_mask;
+    io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = op->fd;
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+    if (op->kind == WAKE || op->kind == NUDGE) {sqe->opcode = IORING_OP_NOP;}
+    else if (op->syncing)
+    {
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    }
+    else
+    {
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->off = op->offset + op->written;
+        sqe->addr = (uint64_t)(uintptr_t)(op->data->data() + op->written);
+        sqe->len = (uint32_t)min(op->data->size() - op->written, MAX_WRITE);
+    }
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    //the completer frees up completion slots without taking the lock, so
+    //a busy ring clears up on its own
+    while (uring_enter(ring->fd, 1, 0, 0) < 0)
+    {
+        int error = errno;
+        if (error == EINTR || error == EAGAIN || error == EBUSY)
+        {
+            this_thread::yield();
+            continue;
+        }
+
+        //take the entry back out, or a later submit would hand the kernel
+        //an op that has already completed
+        if (__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == tail)
+        {
+            __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+            return -error;
+        }
+        //the kernel did consume it, its completion will follow
+        break;
+    }
+    return 0;
+}
+
+//result is what the system call returned, or -errno
+void IoQueue::complete(Op* op, int result)
+{
+    if (result == -EINTR || result == -EAGAIN)
+    {
+        unique_lock<mutex> guard(lock);
+        push_or_fail(op, guard);
+        return;
+    }
+
+    bool ok = result >= 0;
+    if (ok && !op->syncing)
+    {
+        op->written += result;
+        bool more = op->written < op->data->size();
+        if (more && result == 0) {ok = false;}
+        else if (more || op->kind == WRITE_SYNC)
+        {
+            op->syncing = !more;
+            unique_lock<mutex> guard(lock);
+            push_or_fail(op, guard);
+            return;
+        }
+    }
+
+    //done runs before the op stops counting, so drain() covers it
+    if (op->done) {op->done(ok);}
+    delete op;
+    unique_lock<mutex> guard(lock);
+    in_flight--;
+    //the slot goes to work a completion had to put off, if there is any
+    if (!deferred.empty())
+    {
+        Op* next = deferred.front();
+        deferred.pop_front();
+        in_flight++;
+        push_or_fail(next, guard);
+        return;
+    }
+    space.notify_one();
+    if (in_flight == 0) {idle.notify_all();}
+}
+
+void IoQueue::ring_loop()
+{
+    vector<pair<Op*, int>> finished;
+    while (true)
+    {
+        if (uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+        {
+            {
+                lock_guard<mutex> guard(lock);
+                if (stopping) {return;}
+            }
+            this_thread::yield();
+        }
+
+        finished.clear();
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            const io_uring_cqe& cqe = ring->cqes[head & ring->cq_mask];
+            finished.emplace_back((Op*)(uintptr_t)cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        {
+            lock_guard<mutex> guard(lock);
+            finished.insert(finished.end(), refused.begin(), refused.end());
+            refused.clear();
+        }
+
+        bool wake = false;
+        for (const auto& entry : finished)
+        {
+            if (entry.first->kind == WAKE || entry.first->kind == NUDGE)
+            {
+                wake = wake || entry.first->kind == WAKE;
+                delete entry.first;
+            }
+            else {complete(entry.first, entry.second);}
+        }
+        if (wake) {return;}
+    }
+}
+
+void IoQueue::fallback_loop()
+{
+    while (true)
+    {
+        Op* op;
+        {
+            unique_lock<mutex> guard(lock);
+            work_ready.wait(guard, [&] {return stopping || !work.empty();});
+            if (work.empty()) {return;}
+            op = work.front();
+            work.pop_front();
+        }
+
+        int result;
+        if (op->syncing) {result = fdatasync(op->fd) == 0 ? 0 : -errno;}
+        else
+        {
+            size_t size = min(op->data->size() - op->written, MAX_WRITE);
+            ssize_t n = pwrite(op->fd, op->data->data() + op->written, size, op->offset + op->written);
+            result = n < 0 ? -errno : (int)n;
+        }
+        complete(op, result);
+    }
+}
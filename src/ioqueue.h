@@ -0,0 +1,83 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+using namespace std;
+
+//asynchronous file writes and syncs for the persistence layer, so the
+//threads producing data never wait on the disk. Requests go to the kernel
+//through an io_uring when it has one (set up with raw syscalls, no
+//liburing), otherwise a background thread runs them with plain pwrite
+//and fdatasync. Either way completions are delivered on the queue's own
+//thread, in no particular order; a completion may submit more work.
+//At most depth requests are in flight, more from a completion wait their
+//turn without blocking it. A request the kernel refuses completes as failed.
+class IoQueue
+{
+public:
+    typedef function<void(bool ok)> Completion;
+
+private:
+    enum OpKind : uint8_t { WRITE, SYNC, WRITE_SYNC, WAKE, NUDGE };
+
+    struct Op
+    {
+        OpKind kind;
+        int fd;
+        uint64_t offset;
+        shared_ptr<const string> data;
+        size_t written;
+        bool syncing;               //the write part is done
+        Completion done;
+    };
+
+    struct Ring;
+
+    unique_ptr<Ring> ring;          //null when running on the fallback thread
+    thread completer;
+
+    mutex lock;
+    condition_variable idle;
+    condition_variable space;
+    condition_variable work_ready;
+    deque<Op*> work;                //fallback only
+    deque<Op*> deferred;            //submitted by completions while full
+    deque<pair<Op*, int>> refused;  //turned away by the kernel, for the completer to fail
+    size_t in_flight;
+    size_t capacity;
+    bool stopping;
+
+    void submit(Op* op);
+    int push(Op* op);
+    void push_or_fail(Op* op, unique_lock<mutex>& guard);
+    void complete(Op* op, int result);
+    void ring_loop();
+    void fallback_loop();
+
+public:
+    //use_uring false forces the fallback thread, e.g. for testing it
+    explicit IoQueue(bool use_uring = true, unsigned depth = 256);
+    ~IoQueue();
+
+    IoQueue(const IoQueue&) = delete;
+    IoQueue& operator=(const IoQueue&) = delete;
+
+    //true if requests go through io_uring
+    bool uring() const;
+
+    //writes all of data at offset. data is kept alive until done has run.
+    void write(int fd, uint64_t offset, shared_ptr<const string> data, Completion done);
+    //fdatasync
+    void sync(int fd, Completion done);
+    //write() followed by sync() once the write is complete
+    void write_sync(int fd, uint64_t offset, shared_ptr<const string> data, Completion done);
+
+    //blocks until everything submitted so far has completed. Must not be
+    //called from a completion.
+    void drain();
+};
@@ -1,7 +1,52 @@
+#include <fstream>
+#include "alerts.h"
+#include "owners.h"
 #include "pasochan.h"
+#include "replay.h"
+#include "risk.h"
+#include "rules.h"
+#include "snapshot.h"
 
-int main()
+int main(int argc, char** argv)
 {
+    //replay <snapshot> <log> [rule file]: replays a recorded input log as
+    //fast as possible, for benchmarking, from the snapshot it was recorded
+    //after and with the rules the engine had
+    if ((argc == 4 || argc == 5) && string(argv[1]) == "replay")
+    {
+        //the hooks outlive every pet attached to them
+        OwnerIndex owners;
+        AlertMonitor alerts;
+        RiskIndex risk;
+        PetHooks hooks{&owners, &alerts, &risk};
+        PetRegistry registry;
+        if (!load_snapshot(argv[2], registry, nullptr, &hooks)) {return 1;}
+
+        RuleSet rules;
+        if (argc == 5)
+        {
+            ifstream file(argv[4]);
+            if (!file || rules.load(file) > 0)
+            {
+                cout << "Could not load rules from " << argv[4] << endl;
+                return 1;
+            }
+        }
+
+        //the period and decay are set by the log
+        WorkerPool workers;
+        PetPool pool;
+        TickEngine engine(pool, workers, 1000);
+        engine.set_rules(&rules);
+
+        ReplayDriver driver(registry, &hooks);
+        driver.set_engine(&engine, &pool);
+        ReplayStats stats = driver.run(argv[3]);
+        cout << "Replayed " << stats.events << " events (" << stats.ticks << " ticks) in " << stats.elapsed_ms
+             << " ms, " << registry.size() << " pets, " << stats.skipped << " skipped" << endl;
+        return stats.complete ? 0 : 1;
+    }
+
     //create instance of class
     PasoChan paso("bmo");
 
@@ -24,7 +69,7 @@ int main()
     paso.add_owner("dome");
     paso.add_owner("jake");
     paso.add_owner("jorge");
-    vector<string> owners = paso.get_owners();
+    span<const pmr::string> owners = paso.get_owners();
     for (auto it = owners.begin(); it != owners.end(); it++)
     {
         cout << "Owners: " << *it << endl;
@@ -0,0 +1,34 @@
+#include "memory.h"
+#include "rcu.h"
+
+PetMemory::PetMemory(size_t bulk_hint) : bulk_arena(bulk_hint)
+{
+}
+
+pmr::memory_resource* PetMemory::bulk()
+{
+    return &bulk_arena;
+}
+
+vector<pmr::memory_resource*> PetMemory::bulk_shards(size_t count)
+{
+    while (shard_arenas.size() < count) {shard_arenas.emplace_back();}
+
+    vector<pmr::memory_resource*> arenas;
+    for (size_t i = 0; i < count; i++) {arenas.push_back(&shard_arenas[i]);}
+    return arenas;
+}
+
+pmr::memory_resource* PetMemory::churn()
+{
+    return &churn_pool;
+}
+
+void PetMemory::release_bulk()
+{
+    //owner lists replaced while loading may still be waiting on the
+    //reclaimer, they have to go before the memory under them does
+    rcu_collect();
+    bulk_arena.release();
+    for (pmr::monotonic_buffer_resource& arena : shard_arenas) {arena.release();}
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <deque>
+#include <memory_resource>
+#include "pasochan.h"
+
+//memory resources pets and their owner lists are carved from
+class PetMemory
+{
+private:
+    pmr::monotonic_buffer_resource bulk_arena;
+    pmr::synchronized_pool_resource churn_pool;
+    deque<pmr::monotonic_buffer_resource> shard_arenas;
+
+public:
+    //bulk_hint is the size of the arena's first chunk, later chunks grow geometrically
+    explicit PetMemory(size_t bulk_hint = 1 << 20);
+
+    PetMemory(const PetMemory&) = delete;
+    PetMemory& operator=(const PetMemory&) = delete;
+
+    //for loading snapshots from one thread: deallocation is a no-op and
+    //everything is handed back in a few large blocks by release_bulk().
+    //Not thread safe and never frees, so pets loaded into it take their
+    //later owner lists from churn() (see PasoChan::set_owner_resource).
+    pmr::memory_resource* bulk();
+
+    //bulk() split into count separate arenas, one per snapshot shard, so
+    //shards can be loaded on different threads. Call before the threads
+    //start; the arenas are released along with bulk(). Like bulk(), each
+    //arena is only safe for the thread loading its shard, so the pets take
+    //their later owner lists from churn().
+    vector<pmr::memory_resource*> bulk_shards(size_t count);
+
+    //for pets created and deleted while running, thread safe
+    pmr::memory_resource* churn();
+
+    //only call once every pet allocated from bulk() has been destroyed
+    void release_bulk();
+};
@@ -0,0 +1,104 @@
+#include "owners.h"
+
+OwnerIndex::Shard& OwnerIndex::shard_for(OwnerId owner)
+{
+    return shards[owner % SHARD_COUNT];
+}
+
+const OwnerIndex::Shard& OwnerIndex::shard_for(OwnerId owner) const
+{
+    return shards[owner % SHARD_COUNT];
+}
+
+OwnerId OwnerIndex::intern(string_view name)
+{
+    {
+        shared_lock<shared_mutex> guard(names_lock);
+        auto it = ids.find(name);
+        if (it != ids.end()) {return it->second;}
+    }
+
+    unique_lock<shared_mutex> guard(names_lock);
+    auto it = ids.find(name);
+    if (it != ids.end()) {return it->second;}
+
+    //deque keeps the stored names (and the views keyed on them) stable
+    OwnerId id = (OwnerId)names.size();
+    names.emplace_back(name);
+    ids.emplace(names.back(), id);
+    return id;
+}
+
+OwnerId OwnerIndex::lookup(string_view name) const
+{
+    shared_lock<shared_mutex> guard(names_lock);
+    auto it = ids.find(name);
+    if (it == ids.end()) {return NO_OWNER;}
+    return it->second;
+}
+
+string OwnerIndex::name(OwnerId owner) const
+{
+    shared_lock<shared_mutex> guard(names_lock);
+    if (owner >= names.size()) {return string();}
+    return names[owner];
+}
+
+void OwnerIndex::link(OwnerId owner, PetId pet)
+{
+    Shard& shard = shard_for(owner);
+    lock_guard<mutex> guard(shard.lock);
+
+    vector<PetId>& list = shard.postings[owner];
+    if (!shard.positions.emplace(PostingKey{owner, pet}, (uint32_t)list.size()).second) {return;}
+    list.push_back(pet);
+}
+
+void OwnerIndex::unlink(OwnerId owner, PetId pet)
+{
+    Shard& shard = shard_for(owner);
+    lock_guard<mutex> guard(shard.lock);
+
+    auto at = shard.positions.find(PostingKey{owner, pet});
+    if (at == shard.positions.end()) {return;}
+    uint32_t i = at->second;
+    shard.positions.erase(at);
+
+    //order does not matter, swap with the back instead of shifting
+    auto it = shard.postings.find(owner);
+    vector<PetId>& list = it->second;
+    if (i + 1 != list.size())
+    {
+        list[i] = list.back();
+        shard.positions[PostingKey{owner, list[i]}] = i;
+    }
+    list.pop_back();
+    if (list.empty()) {shard.postings.erase(it);}
+}
+
+vector<PetId> OwnerIndex::pets_of(OwnerId owner) const
+{
+    const Shard& shard = shard_for(owner);
+    lock_guard<mutex> guard(shard.lock);
+
+    auto it = shard.postings.find(owner);
+    if (it == shard.postings.end()) {return vector<PetId>();}
+    return it->second;
+}
+
+vector<PetId> OwnerIndex::pets_of(string_view name) const
+{
+    OwnerId owner = lookup(name);
+    if (owner == NO_OWNER) {return vector<PetId>();}
+    return pets_of(owner);
+}
+
+size_t OwnerIndex::pet_count(OwnerId owner) const
+{
+    const Shard& shard = shard_for(owner);
+    lock_guard<mutex> guard(shard.lock);
+
+    auto it = shard.postings.find(owner);
+    if (it == shard.postings.end()) {return 0;}
+    return it->second.size();
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+#include "pasochan.h"
+
+typedef uint32_t OwnerId;
+
+//reverse index from owner to the pets they own, kept up to date by
+//PasoChan::add_owner/remove_owner for every pet attached to it
+class OwnerIndex
+{
+private:
+    static const size_t SHARD_COUNT = 16;
+
+    //where one pet sits in its owner's posting list
+    struct PostingKey
+    {
+        OwnerId owner;
+        PetId pet;
+
+        bool operator==(const PostingKey& other) const
+        {
+            return owner == other.owner && pet == other.pet;
+        }
+    };
+
+    struct PostingKeyHash
+    {
+        size_t operator()(const PostingKey& key) const
+        {
+            return hash<uint64_t>()(key.pet * 0x9e3779b97f4a7c15ULL ^ key.owner);
+        }
+    };
+
+    //one compact posting list per interned owner, plus each entry's
+    //position so unlink is a swap with the back rather than a scan
+    struct alignas(64) Shard
+    {
+        mutable mutex lock;
+        unordered_map<OwnerId, vector<PetId>> postings;
+        unordered_map<PostingKey, uint32_t, PostingKeyHash> positions;
+    };
+
+    //owner names are interned once, ids are handed out densely
+    mutable shared_mutex names_lock;
+    unordered_map<string_view, OwnerId> ids;
+    deque<string> names;
+
+    Shard shards[SHARD_COUNT];
+
+    Shard& shard_for(OwnerId owner);
+    const Shard& shard_for(OwnerId owner) const;
+
+public:
+    static const OwnerId NO_OWNER = ~OwnerId(0);
+
+    //returns the existing id or assigns a new one
+    OwnerId intern(string_view name);
+    //returns NO_OWNER if the name was never interned
+    OwnerId lookup(string_view name) const;
+    string name(OwnerId owner) const;
+
+    //both O(1), linking a pair that is already linked does nothing
+    void link(OwnerId owner, PetId pet);
+    void unlink(OwnerId owner, PetId pet);
+
+    vector<PetId> pets_of(OwnerId owner) const;
+    vector<PetId> pets_of(string_view name) const;
+    size_t pet_count(OwnerId owner) const;
+};
@@ -1,123 +1,512 @@
 #include "pasochan.h"
+#include "alerts.h"
+#include "clock.h"
+#include "owners.h"
+#include "rcu.h"
+#include "replay.h"
+#include "risk.h"
+#include "spinlock.h"
 
-PasoChan::PasoChan(string name)
+struct PasoChan::OwnerList
+{
+    pmr::vector<pmr::string> names;
+
+    explicit OwnerList(const allocator_type& alloc) : names(alloc)
+    {
+    }
+};
+
+PasoChan::PasoChan(string_view name, const allocator_type& alloc) : alloc(alloc), owners_resource(alloc.resource())
 {
     //first owner
-    owners.push_back(name);
+    OwnerList* list = this->alloc.new_object<OwnerList>(this->alloc);
+    list->names.emplace_back(name);
+    owner_list.store(list, memory_order_release);
 
     //starting params
-    health = 100;
-    hunger = 100;
-    happiness = 50;
-    stress = 40;
+    stats.store(PetSchema::initial());
+
+    id = 0;
+    hooks = nullptr;
+    alert_latch.store(0, memory_order_relaxed);
+    risk_entry = RiskIndex::NO_ENTRY;
+    dirty_word = nullptr;
+    dirty_bit = 0;
+}
+
+PasoChan::PasoChan(span<const string> saved_owners, StatWord saved, const allocator_type& alloc)
+    : PasoChan(saved_owners[0], alloc)
+{
+    //nobody can see the pet yet, so the first list is filled in place
+    //rather than published
+    OwnerList* list = const_cast<OwnerList*>(owner_list.load(memory_order_relaxed));
+    list->names.reserve(saved_owners.size());
+    for (size_t i = 1; i < saved_owners.size(); i++) {list->names.emplace_back(saved_owners[i]);}
+    stats.store(saved);
+}
+
+PasoChan::PasoChan(PasoChan&& other) : alloc(other.alloc), owners_resource(other.owners_resource), recent(other.recent)
+{
+    owner_list.store(other.owner_list.exchange(nullptr), memory_order_release);
+    stats.store(other.stats.load());
+
+    //index entries are keyed by id, so they stay valid for the new object
+    id = other.id;
+    hooks = other.hooks;
+    other.hooks = nullptr;
+    alert_latch.store(other.alert_latch.load(memory_order_relaxed), memory_order_relaxed);
+    risk_entry = other.risk_entry;
+    dirty_word = other.dirty_word;
+    dirty_bit = other.dirty_bit;
+    other.dirty_word = nullptr;
+}
+
+PasoChan::~PasoChan()
+{
+    detach();
+
+    //readers of a pet hold a handle to it, so nobody can still see this list
+    const OwnerList* list = owner_list.load(memory_order_acquire);
+    if (list != nullptr) {free_owners(list);}
+}
+
+PasoChan::allocator_type PasoChan::get_allocator() const
+{
+    return alloc;
+}
+
+void PasoChan::set_owner_resource(pmr::memory_resource* resource)
+{
+    SpinGuard guard(owners_writing);
+    owners_resource = resource;
+}
+
+PasoChan::OwnerList* PasoChan::new_owners()
+{
+    allocator_type list_alloc(owners_resource);
+    return list_alloc.new_object<OwnerList>(list_alloc);
+}
+
+void PasoChan::free_owners(const OwnerList* list)
+{
+    //a list goes back to whichever resource it was made from
+    allocator_type list_alloc = list->names.get_allocator();
+    list_alloc.delete_object(const_cast<OwnerList*>(list));
+}
+
+void PasoChan::track_dirty(atomic<uint64_t>* word, uint64_t bit)
+{
+    dirty_word = word;
+    dirty_bit = bit;
 }
 
-void PasoChan::add_owner(string name)
+void PasoChan::mark_dirty()
 {
-    //check if owner already exists
-    for (int i = 0; i < owners.size(); i++)
+    //skip the write when the bit is already set, most pets change every tick
+    if (dirty_word == nullptr) {return;}
+    if ((dirty_word->load(memory_order_relaxed) & dirty_bit) == 0) {dirty_word->fetch_or(dirty_bit, memory_order_relaxed);}
+}
+
+void PasoChan::publish_owners(OwnerList* next)
+{
+    mark_dirty();
+    const OwnerList* old = owner_list.exchange(next);
+    if (old == nullptr) {return;}
+
+    rcu_retire([old]()
     {
-        if (owners[i] == name)
+        free_owners(old);
+    });
+}
+
+PetHandle make_pet(string_view name, pmr::memory_resource* resource)
+{
+    pmr::polymorphic_allocator<PasoChan> alloc(resource);
+    //polymorphic_allocator hands itself to the constructor as the trailing argument
+    return allocate_shared<PasoChan>(alloc, name);
+}
+
+PetHandle make_pet(span<const string> owners, StatWord stats, pmr::memory_resource* resource)
+{
+    pmr::polymorphic_allocator<PasoChan> alloc(resource);
+    return allocate_shared<PasoChan>(alloc, owners, stats);
+}
+
+void PasoChan::attach(PetId pet_id, const PetHooks* pet_hooks)
+{
+    hook(pet_id, pet_hooks, true);
+}
+
+void PasoChan::detach()
+{
+    unhook(true);
+}
+
+static_assert(SuspendedPet{}.risk_entry == RiskIndex::NO_ENTRY, "a fresh SuspendedPet has no risk entry");
+
+SuspendedPet PasoChan::suspend()
+{
+    SuspendedPet saved{risk_entry, alert_latch.load(memory_order_relaxed)};
+    //left in the index so the pet is still ranked while it is paged out
+    risk_entry = RiskIndex::NO_ENTRY;
+    unhook(false);
+    return saved;
+}
+
+void PasoChan::resume(PetId pet_id, const PetHooks* pet_hooks, const SuspendedPet& saved)
+{
+    detach();
+    if (pet_hooks != nullptr)
+    {
+        risk_entry = saved.risk_entry;
+        alert_latch.store(saved.alert_latch, memory_order_relaxed);
+    }
+    hook(pet_id, pet_hooks, false);
+}
+
+void PasoChan::hook(PetId pet_id, const PetHooks* pet_hooks, bool link_owners)
+{
+    detach();
+    id = pet_id;
+    hooks = pet_hooks;
+
+    if (hooks == nullptr) {return;}
+    if (hooks->owners != nullptr && link_owners)
+    {
+        for (const pmr::string& owner : get_owners())
         {
-            cout << name << " is already an owner" << endl;
-            return;
+            hooks->owners->link(hooks->owners->intern(owner), id);
         }
     }
-    owners.push_back(name);
-    cout << "Added " << name << " to owner list" << endl;
+
+    //a resumed pet still has its entry, notify() brings it up to date
+    if (hooks->risk != nullptr && risk_entry == RiskIndex::NO_ENTRY) {risk_entry = hooks->risk->add(id, get_stats());}
+
+    //raise alerts for stats that are past their thresholds and not latched yet
+    notify(get_stats());
 }
 
-void PasoChan::remove_owner(string name)
+void PasoChan::unhook(bool unlink_owners)
 {
-    if (owners.size() <= 1)
+    if (hooks == nullptr) {return;}
+    if (hooks->owners != nullptr && unlink_owners)
     {
-        cout << "Cannot remove last owner!" << endl;
+        //lookup, not intern, so unlinking never adds names to the index
+        for (const pmr::string& owner : get_owners())
+        {
+            OwnerId listed = hooks->owners->lookup(owner);
+            if (listed != OwnerIndex::NO_OWNER) {hooks->owners->unlink(listed, id);}
+        }
+    }
+    if (hooks->risk != nullptr && risk_entry != RiskIndex::NO_ENTRY)
+    {
+        hooks->risk->remove(risk_entry);
+        risk_entry = RiskIndex::NO_ENTRY;
+    }
+    hooks = nullptr;
+}
+
+void PasoChan::notify(const Stats& after)
+{
+    if (hooks->alerts != nullptr) {hooks->alerts->check(id, after, alert_latch);}
+    if (hooks->risk != nullptr && risk_entry != RiskIndex::NO_ENTRY) {hooks->risk->update(risk_entry, *this);}
+}
+
+void PasoChan::add_owner(string_view name)
+{
+    InputRecorder* inputs = hooks != nullptr ? hooks->inputs : nullptr;
+    uint64_t seq = 0;
+    bool added = false;
+    {
+        SpinGuard guard(owners_writing);
+
+        //check if owner already exists
+        if (!is_owner(name))
+        {
+            OwnerList* next = new_owners();
+            const OwnerList* current = owner_list.load(memory_order_acquire);
+            if (current != nullptr)
+            {
+                next->names.reserve(current->names.size() + 1);
+                next->names.assign(current->names.begin(), current->names.end());
+            }
+            next->names.emplace_back(name);
+            publish_owners(next);
+
+            //linked with the lock still held, so a racing remove of the same
+            //name cannot leave the index out of step with the list
+            if (hooks != nullptr && hooks->owners != nullptr)
+            {
+                hooks->owners->link(hooks->owners->intern(name), id);
+            }
+            if (inputs != nullptr) {seq = inputs->sequence();}
+            added = true;
+        }
+    }
+
+    if (!added)
+    {
+        cout << name << " is already an owner" << endl;
         return;
     }
+    if (inputs != nullptr) {inputs->add_owner(seq, id, name);}
+    cout << "Added " << name << " to owner list" << endl;
+}
 
-    bool found = false;
-    for (auto it = owners.begin(); it != owners.end(); ++it)
+void PasoChan::remove_owner(string_view name)
+{
+    InputRecorder* inputs = hooks != nullptr ? hooks->inputs : nullptr;
+    uint64_t seq = 0;
+    //what happened, reported once the lock is released
+    enum {REMOVED, LAST_OWNER, NOT_FOUND} outcome = NOT_FOUND;
     {
-        if (*it == name)
+        SpinGuard guard(owners_writing);
+        span<const pmr::string> owners = get_owners();
+
+        if (owners.size() <= 1) {outcome = LAST_OWNER;}
+        for (auto it = owners.begin(); outcome == NOT_FOUND && it != owners.end(); ++it)
         {
-            found = true;
-            owners.erase(it);
-            cout << "Removed " << name << " from owner list" << endl;
-            return;
+            if (*it != name) {continue;}
+
+            OwnerList* next = new_owners();
+            next->names.reserve(owners.size() - 1);
+            for (auto other = owners.begin(); other != owners.end(); ++other)
+            {
+                if (other != it) {next->names.push_back(*other);}
+            }
+            publish_owners(next);
+
+            if (hooks != nullptr && hooks->owners != nullptr)
+            {
+                OwnerId listed = hooks->owners->lookup(name);
+                if (listed != OwnerIndex::NO_OWNER) {hooks->owners->unlink(listed, id);}
+            }
+            if (inputs != nullptr) {seq = inputs->sequence();}
+            outcome = REMOVED;
         }
     }
 
-    if (!found) 
+    if (outcome == LAST_OWNER)
+    {
+        cout << "Cannot remove last owner!" << endl;
+        return;
+    }
+    if (outcome == NOT_FOUND)
     {
         cout << name << " is not on the owner list" << endl;
+        return;
     }
+    if (inputs != nullptr) {inputs->remove_owner(seq, id, name);}
+    cout << "Removed " << name << " from owner list" << endl;
 }
 
-vector<string> PasoChan::get_owners()
+bool PasoChan::is_owner(string_view name) const
 {
-    return owners;
+    RcuReader reader;
+    for (const pmr::string& owner : get_owners())
+    {
+        if (owner == name) {return true;}
+    }
+    return false;
 }
 
-int PasoChan::get_health()
+PetId PasoChan::get_id() const
 {
-    return health;
+    return id;
 }
 
-int PasoChan::get_hunger()
+span<const pmr::string> PasoChan::get_owners() const
 {
-    return hunger;
+    const OwnerList* list = owner_list.load();
+    if (list == nullptr) {return span<const pmr::string>();}
+    return span<const pmr::string>(list->names.data(), list->names.size());
 }
 
-int PasoChan::get_happiness()
+StatHistory::View PasoChan::history() const
 {
-    return happiness;
+    return recent.view();
 }
 
-int PasoChan::get_stress()
+PetView PasoChan::view() const
 {
-    return stress;
+    //the stats share one atomic word, so this is a single consistent load
+    return PetView{get_stats(), get_owners()};
 }
 
-int PasoChan::update_health(int change)
+int PasoChan::get_health() const
 {
-    health += change;
+    return get_stats().health;
+}
 
-    //check bounds
-    if (health > 100) {health = 100;}
-    if (health < 0) {health = 0;}
+int PasoChan::get_hunger() const
+{
+    return get_stats().hunger;
+}
 
-    return health;
+int PasoChan::get_happiness() const
+{
+    return get_stats().happiness;
 }
 
-int PasoChan::update_hunger(int change)
+int PasoChan::get_stress() const
 {
-    hunger += change;
+    return get_stats().stress;
+}
 
-    //check bounds
-    if (hunger > 100) {hunger = 100;}
-    if (hunger < 0) {hunger = 0;}
+Stats PasoChan::get_stats() const
+{
+    return unpack_stats(stats.load());
+}
 
-    return hunger;
+StatWord PasoChan::get_packed() const
+{
+    return stats.load();
 }
 
-int PasoChan::update_happiness(int change)
+void PasoChan::restore(const Stats& saved, span<const string> saved_owners)
+{
+    //packing clamps to the schema's bounds
+    restore(pack_stats(saved), saved_owners);
+}
+
+void PasoChan::restore(StatWord saved, span<const string> saved_owners)
+{
+    //re-attaching keeps an attached owner index in step with the new list
+    const PetHooks* saved_hooks = hooks;
+    detach();
+
+    {
+        SpinGuard guard(owners_writing);
+        OwnerList* next = new_owners();
+        next->names.reserve(saved_owners.size());
+        for (const string& owner : saved_owners)
+        {
+            next->names.emplace_back(owner);
+        }
+        publish_owners(next);
+    }
+
+    stats.store(saved);
+
+    if (saved_hooks != nullptr) {attach(id, saved_hooks);}
+}
+
+Stats PasoChan::apply(const Action& action)
+{
+    InputRecorder* inputs = hooks != nullptr ? hooks->inputs : nullptr;
+    if (inputs == nullptr) {return apply_derived(action);}
+
+    //a recorded change takes its place in the log under the writer lock,
+    //so clamped changes replay in the order they were made
+    Stats after;
+    uint64_t seq;
+    {
+        SpinGuard guard(owners_writing);
+        after = apply_derived(action);
+        seq = inputs->sequence();
+    }
+    inputs->action(seq, id, action);
+    return after;
+}
+
+Stats PasoChan::apply_fixed(const FixedAction& action)
 {
-    happiness += change;
+    InputRecorder* inputs = hooks != nullptr ? hooks->inputs : nullptr;
+    if (inputs == nullptr) {return apply_fixed_derived(action);}
+
+    Stats after;
+    uint64_t seq;
+    {
+        SpinGuard guard(owners_writing);
+        after = apply_fixed_derived(action);
+        seq = inputs->sequence();
+    }
+    inputs->action_fixed(seq, id, action);
+    return after;
+}
+
+Stats PasoChan::apply_derived(const Action& action)
+{
+    int64_t deltas[STAT_COUNT] = {(int64_t)action.health * STAT_ONE, (int64_t)action.hunger * STAT_ONE,
+                                  (int64_t)action.happiness * STAT_ONE, (int64_t)action.stress * STAT_ONE};
+    return apply_deltas(deltas);
+}
 
-    //check bounds
-    if (happiness > 100) {happiness = 100;}
-    if (happiness < 0) {happiness = 0;}
+Stats PasoChan::apply_fixed_derived(const FixedAction& action)
+{
+    int64_t deltas[STAT_COUNT] = {action.health, action.hunger, action.happiness, action.stress};
+    return apply_deltas(deltas);
+}
+
+Stats PasoChan::apply_deltas(const int64_t (&deltas)[STAT_COUNT])
+{
+    StatWord before = stats.load();
+    StatWord after;
+    do
+    {
+        //check bounds once for the whole action
+        after = PetSchema::add_fixed(before, deltas);
+
+        //fully clamped away, nothing to store or report
+        if (after == before) {return unpack_stats(after);}
+    } while (!stats.compare_exchange(before, after));
+
+    mark_dirty();
+    Stats result = unpack_stats(after);
+
+    //log which stats moved, as they would be shown
+    uint8_t changed[STAT_COUNT];
+    int values[STAT_COUNT];
+    int n = 0;
+    for (int s = 0; s < STAT_COUNT; s++)
+    {
+        int value = PetSchema::get(after, s);
+        if (value == PetSchema::get(before, s)) {continue;}
+        changed[n] = (uint8_t)s;
+        values[n] = value;
+        n++;
+    }
+    //a fraction of a point that rounds the same changes nothing visible
+    if (n == 0) {return result;}
+    recent.record(sim_now(), changed, values, n);
 
-    return happiness;
+    if (hooks != nullptr) {notify(result);}
+    return result;
+}
+
+int PasoChan::update_health(int change)
+{
+    return apply(Action{.health = change}).health;
+}
+
+int PasoChan::update_hunger(int change)
+{
+    return apply(Action{.hunger = change}).hunger;
+}
+
+int PasoChan::update_happiness(int change)
+{
+    return apply(Action{.happiness = change}).happiness;
 }
 
 int PasoChan::update_stress(int change)
 {
-    stress += change;
+    return apply(Action{.stress = change}).stress;
+}
 
-    //check bounds
-    if (stress > 100) {stress = 100;}
-    if (stress < 0) {stress = 0;}
+void apply_all(span<PasoChan* const> pets, const Action& action)
+{
+    for (PasoChan* pet : pets)
+    {
+        pet->apply(action);
+    }
+}
 
-    return stress;
+void apply_all(span<PasoChan* const> pets, span<const Action> actions)
+{
+    size_t n = min(pets.size(), actions.size());
+    for (size_t i = 0; i < n; i++)
+    {
+        pets[i]->apply(actions[i]);
+    }
 }
\ No newline at end of file
@@ -1,36 +1,252 @@
+#pragma once
 #include <stdio.h>
 #include <stdlib.h>
+#include <atomic>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
+#include "history.h"
+#include "stat_schema.h"
+#include "statcell.h"
 using namespace std;
 
-class PasoChan
+typedef uint64_t PetId;
+class OwnerIndex;
+class AlertMonitor;
+class RiskIndex;
+class InputRecorder;
+
+//stat order used wherever stats are addressed by index
+enum StatId : uint8_t
+{
+    HEALTH,
+    HUNGER,
+    HAPPINESS,
+    STRESS,
+    STAT_COUNT
+};
+
+//all four stats as seen at one instant, in whole points
+struct Stats
 {
-private:
-    vector<string> owners;
     int health;
     int hunger;
     int happiness;
     int stress;
+};
+
+static_assert(PetSchema::count == STAT_COUNT, "the schema must define every StatId");
+static_assert(PetSchema::mins[HEALTH] >= 0 && PetSchema::maxs[HEALTH] <= 100
+              && PetSchema::mins[HUNGER] >= 0 && PetSchema::maxs[HUNGER] <= 100
+              && PetSchema::mins[HAPPINESS] >= 0 && PetSchema::maxs[HAPPINESS] <= 100
+              && PetSchema::mins[STRESS] >= 0 && PetSchema::maxs[STRESS] <= 100,
+              "indexes and histograms assume stats stay within 0..100");
+
+typedef PetSchema::word_type StatWord;
+
+inline StatWord pack_stats(const Stats& s)
+{
+    int values[STAT_COUNT] = {s.health, s.hunger, s.happiness, s.stress};
+    return PetSchema::pack(values);
+}
+
+inline Stats unpack_stats(StatWord word)
+{
+    return Stats{PetSchema::get(word, HEALTH), PetSchema::get(word, HUNGER), PetSchema::get(word, HAPPINESS), PetSchema::get(word, STRESS)};
+}
+
+//stat changes that make up one interaction (feed, play, scold...),
+//applied together by PasoChan::apply
+struct Action
+{
+    int health = 0;
+    int hunger = 0;
+    int happiness = 0;
+    int stress = 0;
+};
+
+//an Action in 1/STAT_ONE steps of a point, for changes of less than a
+//point at a time such as slow decay: {.hunger = -STAT_ONE / 7}
+struct FixedAction
+{
+    int health = 0;
+    int hunger = 0;
+    int happiness = 0;
+    int stress = 0;
+};
+
+inline FixedAction to_fixed(const Action& action)
+{
+    return FixedAction{action.health * STAT_ONE, action.hunger * STAT_ONE, action.happiness * STAT_ONE,
+                       action.stress * STAT_ONE};
+}
+
+//shared services a pet reports to once attached, any of them may be nullptr
+struct PetHooks
+{
+    OwnerIndex* owners = nullptr;
+    AlertMonitor* alerts = nullptr;
+    RiskIndex* risk = nullptr;
+    //records the pet's actions and owner changes, for replay
+    InputRecorder* inputs = nullptr;
+};
+
+//what a pet paged out to storage leaves with its hooks, handed back when
+//it is reloaded: its risk index entry, still ranked by its last stats,
+//and its alert latch bits, so alerts that already fired stay quiet
+struct SuspendedPet
+{
+    uint32_t risk_entry = ~uint32_t(0);     //RiskIndex::NO_ENTRY
+    uint8_t alert_latch = 0;
+};
+
+//consistent read of a pet, the owner span is only valid inside an RcuReader
+struct PetView
+{
+    Stats stats;
+    span<const pmr::string> owners;
+};
+
+class PasoChan
+{
+public:
+    //owner list and owner names come from this allocator's resource
+    typedef pmr::polymorphic_allocator<> allocator_type;
+
+private:
+    struct OwnerList;
+
+    //published read-copy-update style: readers load the pointer without
+    //locking, writers build a new list and retire the old one (see rcu.h)
+    allocator_type alloc;
+    //where owner lists made after construction come from, alloc's
+    //resource unless moved with set_owner_resource()
+    pmr::memory_resource* owners_resource;
+    atomic<const OwnerList*> owner_list;
+    //serialises owner list writers, and recorded changes so each takes
+    //its place in the input log in the order it was made. Readers never
+    //touch it.
+    atomic_flag owners_writing;
+
+    //all stats packed per PetSchema so a whole action lands with a
+    //single compare-exchange
+    StatCell<StatWord> stats;
+
+    //where ownership and stat changes are reported, if anywhere
+    PetId id;
+    const PetHooks* hooks;
+
+    //one bit per stat that is currently past its alert threshold
+    atomic<uint8_t> alert_latch;
+    //handle into hooks->risk
+    uint32_t risk_entry;
+
+    //recent changes, stamped with sim_now()
+    StatHistory recent;
+
+    //bit set in a pool's dirty bitmap whenever this pet changes
+    atomic<uint64_t>* dirty_word;
+    uint64_t dirty_bit;
+
+    void notify(const Stats& after);
+    void mark_dirty();
+    Stats apply_deltas(const int64_t (&deltas)[STAT_COUNT]);
+    void publish_owners(OwnerList* next);
+    OwnerList* new_owners();
+    static void free_owners(const OwnerList* list);
+    void hook(PetId pet_id, const PetHooks* pet_hooks, bool link_owners);
+    void unhook(bool unlink_owners);
 
 public:
     //constructor
-    PasoChan(string name);
+    PasoChan(string_view name, const allocator_type& alloc = allocator_type());
+    //a pet as it was saved, owners (at least one) and packed stats, built
+    //in one go without publishing and retiring a second owner list
+    PasoChan(span<const string> saved_owners, StatWord saved, const allocator_type& alloc = allocator_type());
+    ~PasoChan();
 
-    void add_owner(string name);
-    void remove_owner(string name);
+    //attached pets keep their owners listed in the hooks' index, a moved-to pet
+    //takes over the attachment and the moved-from pet is left detached
+    PasoChan(PasoChan&& other);
+    PasoChan(const PasoChan&) = delete;
+    PasoChan& operator=(const PasoChan&) = delete;
 
-    //getters
-    vector<string> get_owners();
-    int get_health();
-    int get_hunger();
-    int get_happiness();
-    int get_stress();
+    allocator_type get_allocator() const;
+
+    //owner lists made from now on come from resource, each list is still
+    //freed to the resource it came from. Pets loaded into an arena are moved
+    //onto PetMemory::churn() this way before they are shared, so owner
+    //changes neither race on the arena nor grow it.
+    void set_owner_resource(pmr::memory_resource* resource);
+
+    void attach(PetId pet_id, const PetHooks* pet_hooks);
+    void detach();
+
+    //detach() for a pet being paged out to storage: it stays listed in the
+    //owner index and the risk index, and resume() hooks the reloaded pet
+    //back up without listing it twice or raising its alerts again
+    SuspendedPet suspend();
+    void resume(PetId pet_id, const PetHooks* pet_hooks, const SuspendedPet& saved);
+
+    //every later change to stats or owners sets bit in word, word may be
+    //nullptr to stop. Used by PetPool for incremental checkpoints.
+    void track_dirty(atomic<uint64_t>* word, uint64_t bit);
+
+    void add_owner(string_view name);
+    void remove_owner(string_view name);
+    bool is_owner(string_view name) const;
+
+    //getters, the owner span stays valid inside an RcuReader, or until
+    //the next owner change when there is only one thread
+    PetId get_id() const;
+    span<const pmr::string> get_owners() const;
+    PetView view() const;
+
+    //most recent stat changes, newest first, copied out under the history's lock
+    StatHistory::View history() const;
+    //whole points, rounded
+    int get_health() const;
+    int get_hunger() const;
+    int get_happiness() const;
+    int get_stress() const;
+    Stats get_stats() const;
+    //all stats packed per PetSchema, fractions of a point included
+    StatWord get_packed() const;
+
+    //puts back state read from a snapshot, no owner messages are printed
+    void restore(const Stats& saved, span<const string> saved_owners);
+    void restore(StatWord saved, span<const string> saved_owners);
+
+    //adds every delta in the action and clamps once, atomically,
+    //returns the resulting stats
+    Stats apply(const Action& action);
+    //the same in fixed point. History and hooks only hear about changes
+    //that move a stat's whole-point value.
+    Stats apply_fixed(const FixedAction& action);
+    //apply() and apply_fixed() for changes the simulation makes on its own
+    //(tick decay, rules), which are not recorded as inputs since replay
+    //makes them again from the recorded ticks
+    Stats apply_derived(const Action& action);
+    Stats apply_fixed_derived(const FixedAction& action);
 
     //for raising or decreasing params 
     int update_health(int change);
     int update_hunger(int change);
     int update_happiness(int change);
     int update_stress(int change);
-};
\ No newline at end of file
+};
+
+typedef shared_ptr<PasoChan> PetHandle;
+
+//allocates the pet (and its shared_ptr control block) from the resource
+PetHandle make_pet(string_view name, pmr::memory_resource* resource = pmr::get_default_resource());
+PetHandle make_pet(span<const string> owners, StatWord stats, pmr::memory_resource* resource = pmr::get_default_resource());
+
+//batch forms of PasoChan::apply, the same action for every pet or one action per pet
+void apply_all(span<PasoChan* const> pets, const Action& action);
+void apply_all(span<PasoChan* const> pets, span<const Action> actions);
\ No newline at end of file
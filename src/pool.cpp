@@ -0,0 +1,156 @@
+#include "pool.h"
+#include "columns.h"
+#include <bit>
+
+static const size_t DIRTY_WORDS = PetPool::CHUNK_SIZE / 64;
+
+PetPool::PetPool()
+{
+    live = 0;
+    columns = nullptr;
+}
+
+PetPool::~PetPool()
+{
+    //pets can outlive the pool, stop them writing into its bitmap
+    for (PasoChan* pet : pets)
+    {
+        if (pet != nullptr) {pet->track_dirty(nullptr, 0);}
+    }
+}
+
+void PetPool::attach_columns(ColumnStore* store)
+{
+    columns = store;
+    if (columns != nullptr) {columns->resize(pets.size());}
+}
+
+ColumnStore* PetPool::get_columns() const
+{
+    return columns;
+}
+
+PetSlot PetPool::add(PetHandle pet)
+{
+    PetSlot slot;
+    if (!free_slots.empty())
+    {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    }
+    else
+    {
+        slot = (PetSlot)pets.size();
+        handles.emplace_back();
+        pets.push_back(nullptr);
+        if (slot % CHUNK_SIZE == 0) {dirty.push_back(make_unique<atomic<uint64_t>[]>(DIRTY_WORDS));}
+    }
+
+    //a new pet always goes into the next checkpoint
+    atomic<uint64_t>& word = dirty[slot / CHUNK_SIZE][slot % CHUNK_SIZE / 64];
+    uint64_t bit = uint64_t(1) << (slot % 64);
+    word.fetch_or(bit, memory_order_relaxed);
+    pet->track_dirty(&word, bit);
+
+    pets[slot] = pet.get();
+    handles[slot] = std::move(pet);
+    live++;
+
+    //a reused slot starts over from the columns' initial values
+    if (columns != nullptr) {columns->reset(slot);}
+    return slot;
+}
+
+void PetPool::remove(PetSlot slot)
+{
+    if (slot >= pets.size() || pets[slot] == nullptr) {return;}
+
+    pets[slot]->track_dirty(nullptr, 0);
+    removed.push_back(pets[slot]->get_id());
+    pets[slot] = nullptr;
+    handles[slot].reset();
+    free_slots.push_back(slot);
+    live--;
+}
+
+PasoChan* PetPool::get(PetSlot slot) const
+{
+    if (slot >= pets.size()) {return nullptr;}
+    return pets[slot];
+}
+
+PetHandle PetPool::handle(PetSlot slot) const
+{
+    if (slot >= handles.size()) {return PetHandle();}
+    return handles[slot];
+}
+
+size_t PetPool::size() const
+{
+    return live;
+}
+
+size_t PetPool::slot_count() const
+{
+    return pets.size();
+}
+
+size_t PetPool::chunk_count() const
+{
+    return (pets.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+
+span<PasoChan* const> PetPool::chunk(size_t index) const
+{
+    size_t begin = index * CHUNK_SIZE;
+    if (begin >= pets.size()) {return span<PasoChan* const>();}
+    size_t end = min(begin + CHUNK_SIZE, pets.size());
+    return span<PasoChan* const>(pets.data() + begin, end - begin);
+}
+
+span<PasoChan* const> PetPool::all() const
+{
+    return span<PasoChan* const>(pets.data(), pets.size());
+}
+
+vector<PetSlot> PetPool::take_dirty()
+{
+    vector<PetSlot> slots;
+    for (size_t c = 0; c < dirty.size(); c++)
+    {
+        for (size_t w = 0; w < DIRTY_WORDS; w++)
+        {
+            uint64_t bits = dirty[c][w].load(memory_order_relaxed);
+            if (bits == 0) {continue;}
+            bits = dirty[c][w].exchange(0, memory_order_acquire);
+            while (bits != 0)
+            {
+                PetSlot slot = (PetSlot)(c * CHUNK_SIZE + w * 64 + countr_zero(bits));
+                bits &= bits - 1;
+                if (slot < pets.size() && pets[slot] != nullptr) {slots.push_back(slot);}
+            }
+        }
+    }
+    return slots;
+}
+
+void PetPool::mark_dirty(PetSlot slot)
+{
+    if (slot >= pets.size()) {return;}
+    dirty[slot / CHUNK_SIZE][slot % CHUNK_SIZE / 64].fetch_or(uint64_t(1) << (slot % 64), memory_order_relaxed);
+}
+
+void PetPool::mark_all_dirty()
+{
+    for (PetSlot slot = 0; slot < pets.size(); slot++)
+    {
+        if (pets[slot] != nullptr) {mark_dirty(slot);}
+    }
+}
+
+vector<PetId> PetPool::take_removed()
+{
+    vector<PetId> ids;
+    ids.swap(removed);
+    return ids;
+}
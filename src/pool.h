@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include "pasochan.h"
+
+typedef uint32_t PetSlot;
+class ColumnStore;
+
+//dense, slot-addressed list of the pets being simulated, so batch kernels
+//walk a flat array instead of the registry's hash shards. Slots are
+//stable while a pet is in the pool and freed slots are reused.
+//Adding and removing pets is not thread safe and happens between ticks.
+class PetPool
+{
+private:
+    vector<PetHandle> handles;
+    vector<PasoChan*> pets;     //same slots as handles, nullptr when free
+    vector<PetSlot> free_slots;
+    size_t live;
+    ColumnStore* columns;
+
+    //one bit per slot, set by the pet whenever it changes. Allocated a chunk
+    //at a time so the words pets point at never move.
+    vector<unique_ptr<atomic<uint64_t>[]>> dirty;
+    vector<PetId> removed;
+
+public:
+    //batch kernels work through the pool this many slots at a time
+    static constexpr size_t CHUNK_SIZE = 1024;
+
+    static const PetSlot NO_SLOT = ~PetSlot(0);
+
+    PetPool();
+    ~PetPool();
+
+    PetPool(const PetPool&) = delete;
+    PetPool& operator=(const PetPool&) = delete;
+
+    //runtime stat columns indexed by this pool's slots, may be nullptr
+    void attach_columns(ColumnStore* store);
+    ColumnStore* get_columns() const;
+
+    PetSlot add(PetHandle pet);
+    void remove(PetSlot slot);
+
+    //nullptr for free slots
+    PasoChan* get(PetSlot slot) const;
+    PetHandle handle(PetSlot slot) const;
+
+    //number of live pets
+    size_t size() const;
+    //one past the highest slot ever used
+    size_t slot_count() const;
+
+    size_t chunk_count() const;
+    //slots [chunk * CHUNK_SIZE, ...) with nullptr for free slots
+    span<PasoChan* const> chunk(size_t index) const;
+    span<PasoChan* const> all() const;
+
+    //slots whose pet was added or changed since the last call, clearing
+    //their bits. Safe to call while pets are being changed, a change that
+    //races with it shows up in the next call.
+    vector<PetSlot> take_dirty();
+    void mark_dirty(PetSlot slot);
+    void mark_all_dirty();
+    //ids of pets removed since the last call
+    vector<PetId> take_removed();
+};
@@ -0,0 +1,121 @@
+#include "rcu.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+//readers beyond this many threads fall back to pinning the oldest epoch
+static const size_t MAX_READERS = 256;
+//retired versions are collected in batches of this size
+static const size_t COLLECT_EVERY = 64;
+
+struct alignas(64) ReaderSlot
+{
+    atomic<uint64_t> epoch{0};     //0 when not reading
+    atomic<bool> claimed{false};
+};
+
+struct Retired
+{
+    uint64_t epoch;
+    function<void()> reclaim;
+};
+
+static atomic<uint64_t> global_epoch{1};
+static ReaderSlot slots[MAX_READERS];
+static atomic<uint64_t> overflow_readers{0};
+
+static mutex retired_lock;
+static vector<Retired> retired;
+
+//each thread claims a slot on first use and gives it back when it exits
+struct ThreadSlot
+{
+    ReaderSlot* slot = nullptr;
+    int depth = 0;
+
+    ThreadSlot()
+    {
+        for (ReaderSlot& candidate : slots)
+        {
+            bool expected = false;
+            if (candidate.claimed.compare_exchange_strong(expected, true))
+            {
+                slot = &candidate;
+                return;
+            }
+        }
+    }
+
+    ~ThreadSlot()
+    {
+        if (slot != nullptr) {slot->claimed.store(false);}
+    }
+};
+
+static thread_local ThreadSlot self;
+
+RcuReader::RcuReader()
+{
+    if (self.depth++ > 0) {return;}
+    if (self.slot == nullptr)
+    {
+        overflow_readers.fetch_add(1);
+        return;
+    }
+    //seq_cst so the epoch is visible before any protected pointer is loaded
+    self.slot->epoch.store(global_epoch.load());
+}
+
+RcuReader::~RcuReader()
+{
+    if (--self.depth > 0) {return;}
+    if (self.slot == nullptr)
+    {
+        overflow_readers.fetch_sub(1);
+        return;
+    }
+    self.slot->epoch.store(0, memory_order_release);
+}
+
+void rcu_retire(function<void()> reclaim)
+{
+    //the old version was unpublished before this point, so any reader
+    //that can still hold it entered at or before this epoch
+    uint64_t epoch = global_epoch.fetch_add(1);
+
+    size_t pending;
+    {
+        lock_guard<mutex> guard(retired_lock);
+        retired.push_back(Retired{epoch, std::move(reclaim)});
+        pending = retired.size();
+    }
+    if (pending >= COLLECT_EVERY) {rcu_collect();}
+}
+
+size_t rcu_collect()
+{
+    //oldest epoch any reader is still in
+    uint64_t oldest = global_epoch.load();
+    if (overflow_readers.load() != 0) {oldest = 0;}
+    for (ReaderSlot& slot : slots)
+    {
+        uint64_t epoch = slot.epoch.load();
+        if (epoch != 0 && epoch < oldest) {oldest = epoch;}
+    }
+
+    vector<Retired> ready;
+    {
+        lock_guard<mutex> guard(retired_lock);
+        size_t kept = 0;
+        for (size_t i = 0; i < retired.size(); i++)
+        {
+            if (retired[i].epoch < oldest) {ready.push_back(std::move(retired[i]));}
+            else {retired[kept++] = std::move(retired[i]);}
+        }
+        retired.resize(kept);
+    }
+
+    //run outside the lock, reclaimers may retire more
+    for (Retired& item : ready) {item.reclaim();}
+    return ready.size();
+}
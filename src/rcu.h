@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+using namespace std;
+
+//minimal epoch-based RCU. Readers publish the epoch they started in and
+//never block or write shared state; writers swap in a new version of the
+//data and retire the old one, which is freed once every reader that could
+//still see it has left its read section.
+
+//read-side section, may be nested, pointers loaded inside stay valid until it ends
+class RcuReader
+{
+public:
+    RcuReader();
+    ~RcuReader();
+
+    RcuReader(const RcuReader&) = delete;
+    RcuReader& operator=(const RcuReader&) = delete;
+};
+
+//hands an unpublished old version to the reclaimer
+void rcu_retire(function<void()> reclaim);
+
+//frees whatever no reader can still see, returns how many were freed
+size_t rcu_collect();
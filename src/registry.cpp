@@ -0,0 +1,183 @@
+#include "registry.h"
+
+static const size_t MIN_CAPACITY = 16;
+
+PetRegistry::PetRegistry()
+{
+    for (size_t s = 0; s < SHARD_COUNT; s++)
+    {
+        shards[s].slots.resize(MIN_CAPACITY);
+    }
+}
+
+uint64_t PetRegistry::mix(PetId id)
+{
+    //splitmix64 finalizer, sequential ids spread across shards and slots
+    uint64_t x = id;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+PetRegistry::Shard& PetRegistry::shard_for(uint64_t hash)
+{
+    return shards[hash >> (64 - SHARD_BITS)];
+}
+
+const PetRegistry::Shard& PetRegistry::shard_for(uint64_t hash) const
+{
+    return shards[hash >> (64 - SHARD_BITS)];
+}
+
+long PetRegistry::probe(const Shard& shard, PetId id, uint64_t hash)
+{
+    size_t mask = shard.slots.size() - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask)
+    {
+        const Slot& slot = shard.slots[i];
+        if (slot.state == EMPTY) {return -1;}
+        if (slot.state == FULL && slot.id == id) {return (long)i;}
+    }
+}
+
+void PetRegistry::rehash(Shard& shard, size_t capacity)
+{
+    vector<Slot> old(capacity);
+    old.swap(shard.slots);
+
+    size_t mask = capacity - 1;
+    for (Slot& slot : old)
+    {
+        if (slot.state != FULL) {continue;}
+        size_t i = mix(slot.id) & mask;
+        while (shard.slots[i].state == FULL) {i = (i + 1) & mask;}
+        shard.slots[i] = std::move(slot);
+    }
+    shard.used = shard.live;
+}
+
+void PetRegistry::reserve(size_t pets)
+{
+    size_t per_shard = pets / SHARD_COUNT + 1;
+    size_t capacity = MIN_CAPACITY;
+    //keep the load factor under 70%
+    while (capacity * 7 < per_shard * 10) {capacity *= 2;}
+
+    for (size_t s = 0; s < SHARD_COUNT; s++)
+    {
+        unique_lock<shared_mutex> guard(shards[s].lock);
+        if (shards[s].slots.size() < capacity) {rehash(shards[s], capacity);}
+    }
+}
+
+PetHandle PetRegistry::find(PetId id) const
+{
+    uint64_t hash = mix(id);
+    const Shard& shard = shard_for(hash);
+    shared_lock<shared_mutex> guard(shard.lock);
+
+    long i = probe(shard, id, hash);
+    if (i < 0) {return PetHandle();}
+    return shard.slots[i].pet;
+}
+
+bool PetRegistry::contains(PetId id) const
+{
+    uint64_t hash = mix(id);
+    const Shard& shard = shard_for(hash);
+    shared_lock<shared_mutex> guard(shard.lock);
+    return probe(shard, id, hash) >= 0;
+}
+
+bool PetRegistry::insert(PetId id, PetHandle pet)
+{
+    uint64_t hash = mix(id);
+    Shard& shard = shard_for(hash);
+    unique_lock<shared_mutex> guard(shard.lock);
+
+    if (probe(shard, id, hash) >= 0) {return false;}
+
+    //grow (or just purge tombstones) before crossing 70% occupancy
+    if ((shard.used + 1) * 10 > shard.slots.size() * 7)
+    {
+        size_t capacity = shard.slots.size();
+        if ((shard.live + 1) * 10 > capacity * 5) {capacity *= 2;}
+        rehash(shard, capacity);
+    }
+
+    size_t mask = shard.slots.size() - 1;
+    size_t i = hash & mask;
+    while (shard.slots[i].state == FULL) {i = (i + 1) & mask;}
+
+    Slot& slot = shard.slots[i];
+    if (slot.state == EMPTY) {shard.used++;}
+    slot.id = id;
+    slot.state = FULL;
+    slot.pet = std::move(pet);
+    shard.live++;
+    count.fetch_add(1, memory_order_relaxed);
+    return true;
+}
+
+bool PetRegistry::erase(PetId id)
+{
+    uint64_t hash = mix(id);
+    Shard& shard = shard_for(hash);
+    PetHandle dropped;
+    {
+        unique_lock<shared_mutex> guard(shard.lock);
+        long i = probe(shard, id, hash);
+        if (i < 0) {return false;}
+
+        Slot& slot = shard.slots[i];
+        slot.state = DELETED;
+        dropped.swap(slot.pet);
+        shard.live--;
+    }
+    //the pet itself is released outside the shard lock
+    count.fetch_sub(1, memory_order_relaxed);
+    return true;
+}
+
+PetHandle PetRegistry::emplace(PetId id, string_view name, pmr::memory_resource* resource)
+{
+    if (contains(id)) {return PetHandle();}
+
+    PetHandle pet = make_pet(name, resource);
+    if (!insert(id, pet)) {return PetHandle();}
+    return pet;
+}
+
+void PetRegistry::clear()
+{
+    for (size_t s = 0; s < SHARD_COUNT; s++)
+    {
+        vector<Slot> dropped(MIN_CAPACITY);
+        {
+            unique_lock<shared_mutex> guard(shards[s].lock);
+            dropped.swap(shards[s].slots);
+            count.fetch_sub(shards[s].live, memory_order_relaxed);
+            shards[s].used = 0;
+            shards[s].live = 0;
+        }
+    }
+}
+
+size_t PetRegistry::size() const
+{
+    return count.load(memory_order_relaxed);
+}
+
+vector<pair<PetId, PetHandle>> PetRegistry::snapshot() const
+{
+    vector<pair<PetId, PetHandle>> out;
+    out.reserve(size());
+    for_each([&](PetId id, const PetHandle& pet)
+    {
+        out.emplace_back(id, pet);
+    });
+    return out;
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include "pasochan.h"
+
+//maps pet ids to pets, split into independently locked shards so
+//lookups from different relay connections do not contend
+class PetRegistry
+{
+private:
+    static const size_t SHARD_BITS = 6;
+    static const size_t SHARD_COUNT = size_t(1) << SHARD_BITS;
+
+    enum SlotState : uint8_t { EMPTY, FULL, DELETED };
+
+    struct Slot
+    {
+        PetId id = 0;
+        SlotState state = EMPTY;
+        PetHandle pet;
+    };
+
+    //open addressing with linear probing, capacity is always a power of two
+    struct alignas(64) Shard
+    {
+        mutable shared_mutex lock;
+        vector<Slot> slots;
+        size_t used = 0;      //full + deleted slots
+        size_t live = 0;      //full slots only
+    };
+
+    Shard shards[SHARD_COUNT];
+    atomic<size_t> count{0};
+
+    static uint64_t mix(PetId id);
+    Shard& shard_for(uint64_t hash);
+    const Shard& shard_for(uint64_t hash) const;
+    static long probe(const Shard& shard, PetId id, uint64_t hash);
+    static void rehash(Shard& shard, size_t capacity);
+
+public:
+    PetRegistry();
+
+    //pre-size the shards for an expected number of pets
+    void reserve(size_t pets);
+
+    //returns an empty handle when the id is unknown
+    PetHandle find(PetId id) const;
+    bool contains(PetId id) const;
+
+    //returns false and leaves the registry unchanged if the id is taken
+    bool insert(PetId id, PetHandle pet);
+    bool erase(PetId id);
+
+    //creates a pet from the given resource (see PetMemory) and registers it,
+    //returns an empty handle if the id is taken
+    PetHandle emplace(PetId id, string_view name, pmr::memory_resource* resource = pmr::get_default_resource());
+
+    //drops every pet, e.g. before releasing the arena they were loaded into
+    void clear();
+
+    size_t size() const;
+
+    //visits every pet, holding one shard's read lock at a time
+    template <typename Fn>
+    void for_each(Fn fn) const
+    {
+        for (size_t s = 0; s < SHARD_COUNT; s++)
+        {
+            shared_lock<shared_mutex> guard(shards[s].lock);
+            for (const Slot& slot : shards[s].slots)
+            {
+                if (slot.state == FULL) {fn(slot.id, slot.pet);}
+            }
+        }
+    }
+
+    //copy of all (id, pet) pairs, consistent per shard
+    vector<pair<PetId, PetHandle>> snapshot() const;
+};
@@ -0,0 +1,625 @@
+#include "replay.h"
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include "checksum.h"
+#include "codec.h"
+#include "compress.h"
+#include "rcu.h"
+#include "snapshot.h"
+
+static const char MAGIC[8] = {'P', 'A', 'S', 'O', 'R', 'E', 'P', 'L'};
+static const uint32_t VERSION = 3;
+static const size_t HEADER_SIZE = sizeof(MAGIC) + 4 + 4;
+//events are buffered up to about this size before a block is written
+static const size_t RECORD_BLOCK_BYTES = 256 << 10;
+//no recorder writes a packed block anywhere near this big
+static const uint32_t MAX_PACKED_BYTES = 64 << 20;
+
+//signed values as varints, small magnitudes either way stay short
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static bool get_signed(string_view& in, int& v)
+{
+    uint64_t raw;
+    if (!get_varint(in, raw)) {return false;}
+    v = (int)unzigzag(raw);
+    return true;
+}
+
+static void put_deltas(string& out, int health, int hunger, int happiness, int stress)
+{
+    put_varint(out, zigzag(health));
+    put_varint(out, zigzag(hunger));
+    put_varint(out, zigzag(happiness));
+    put_varint(out, zigzag(stress));
+}
+
+template <typename T>
+static bool get_deltas(string_view& in, T& deltas)
+{
+    return get_signed(in, deltas.health) && get_signed(in, deltas.hunger) && get_signed(in, deltas.happiness)
+           && get_signed(in, deltas.stress);
+}
+
+//a name or payload as it is staged, length then bytes
+static void put_text(string& out, string_view text)
+{
+    put_varint(out, text.size());
+    out.append(text);
+}
+
+static bool get_text(string_view& in, string_view& text)
+{
+    uint64_t size;
+    return get_varint(in, size) && get_bytes(in, size, text);
+}
+
+//starts a staged event in the calling thread's buffer, which stage() copies
+static string& start_event(uint64_t seq, InputKind kind)
+{
+    thread_local string event;
+    event.clear();
+    put_u64(event, seq);
+    put_u64(event, sim_now());
+    put_u8(event, kind);
+    return event;
+}
+
+InputRecorder::InputRecorder()
+{
+    next_sequence = 0;
+    staged_bytes = 0;
+    events = 0;
+    active = false;
+    fd = -1;
+    offset = 0;
+    expected = 0;
+    last_time = 0;
+    failed = false;
+}
+
+InputRecorder::~InputRecorder()
+{
+    close();
+}
+
+bool InputRecorder::open(const string& path)
+{
+    close();
+    int file = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0)
+    {
+        cout << "Could not create input log " << path << endl;
+        return false;
+    }
+
+    auto header = make_shared<string>(MAGIC, sizeof(MAGIC));
+    put_u32(*header, VERSION);
+    put_u32(*header, PetSchema::fingerprint());
+
+    lock_guard<mutex> guard(lock);
+    for (Shard& shard : shards)
+    {
+        lock_guard<mutex> shard_guard(shard.lock);
+        shard.staged.clear();
+    }
+    //numbers taken before now belong to no log and are dropped
+    expected = next_sequence.load();
+    staged_bytes = 0;
+    events = 0;
+    fd = file;
+    offset = header->size();
+    held.clear();
+    block.clear();
+    last_time = 0;
+    names.clear();
+    failed = false;
+    io.write(fd, 0, header, [this](bool ok) {if (!ok) {failed = true;}});
+    active = true;
+    return true;
+}
+
+bool InputRecorder::close()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        if (fd < 0) {return !failed;}
+        active = false;
+        //a number still missing now was never recorded, nothing waits on it
+        merge(true);
+        write_block();
+    }
+    //the queue does not order a sync after the writes before it
+    io.drain();
+    io.sync(fd, [this](bool ok) {if (!ok) {failed = true;}});
+    io.drain();
+
+    lock_guard<mutex> guard(lock);
+    ::close(fd);
+    fd = -1;
+    if (failed) {cout << "Could not write the input log" << endl;}
+    return !failed;
+}
+
+void InputRecorder::stage(PetId key, const string& event)
+{
+    Shard& shard = shards[key & (SHARD_COUNT - 1)];
+    size_t added;
+    {
+        lock_guard<mutex> guard(shard.lock);
+        size_t before = shard.staged.size();
+        put_text(shard.staged, event);
+        added = shard.staged.size() - before;
+    }
+    events++;
+
+    //whoever stages a block's worth merges it, if nobody else already is
+    if (staged_bytes.fetch_add(added) + added < RECORD_BLOCK_BYTES) {return;}
+    unique_lock<mutex> guard(lock, try_to_lock);
+    if (!guard.owns_lock() || fd < 0) {return;}
+    merge(false);
+    write_block();
+}
+
+//moves the staged events into the block in sequence order, with lock
+//held. Events after a number that is taken but not staged yet are held
+//back for the next merge, unless all is set.
+void InputRecorder::merge(bool all)
+{
+    string gathered;
+    gathered.swap(held);
+    for (Shard& shard : shards)
+    {
+        lock_guard<mutex> guard(shard.lock);
+        staged_bytes -= shard.staged.size();
+        gathered.append(shard.staged);
+        shard.staged.clear();
+    }
+
+    vector<pair<uint64_t, string_view>> order;
+    string_view rest(gathered);
+    string_view event;
+    while (get_text(rest, event))
+    {
+        string_view fields = event;
+        uint64_t seq;
+        if (get_u64(fields, seq) && seq >= expected) {order.emplace_back(seq, event);}
+    }
+    sort(order.begin(), order.end(), [](const auto& a, const auto& b) {return a.first < b.first;});
+
+    size_t i = 0;
+    for (; i < order.size() && (all || order[i].first == expected); i++)
+    {
+        commit(order[i].second);
+        expected = order[i].first + 1;
+    }
+    for (; i < order.size(); i++) {put_text(held, order[i].second);}
+}
+
+//appends one staged event to the block: time since the previous event,
+//kind, then its fields with owner names interned
+void InputRecorder::commit(string_view event)
+{
+    uint64_t seq;
+    SimTime now;
+    uint8_t kind;
+    get_u64(event, seq);
+    get_u64(event, now);
+    get_u8(event, kind);
+    put_varint(block, zigzag((int64_t)(now - last_time)));
+    put_u8(block, kind);
+    last_time = now;
+
+    uint64_t pet;
+    uint64_t count;
+    string_view name;
+    switch (kind)
+    {
+        case INPUT_CREATE:
+            get_varint(event, pet);
+            put_varint(block, pet);
+            block.append(event.substr(0, PetSchema::bytes));
+            event.remove_prefix(PetSchema::bytes);
+            get_varint(event, count);
+            put_varint(block, count);
+            for (uint64_t i = 0; i < count && get_text(event, name); i++) {put_name(name);}
+            break;
+        case INPUT_ADD_OWNER: case INPUT_REMOVE_OWNER:
+            get_varint(event, pet);
+            put_varint(block, pet);
+            get_text(event, name);
+            put_name(name);
+            break;
+        //the rest are staged as they are logged
+        default: block.append(event); break;
+    }
+}
+
+//a name seen before is its index plus one, a new one is 0 and the name
+void InputRecorder::put_name(string_view name)
+{
+    auto found = names.find(string(name));
+    if (found != names.end())
+    {
+        put_varint(block, found->second + 1);
+        return;
+    }
+    put_varint(block, 0);
+    put_text(block, name);
+    names.emplace(string(name), (uint32_t)names.size());
+}
+
+//compresses the buffered events and queues them behind the previous
+//block, with lock held
+void InputRecorder::write_block()
+{
+    if (block.empty()) {return;}
+
+    string packed;
+    compress(block, packed);
+    block.clear();
+
+    auto data = make_shared<string>();
+    put_u32(*data, (uint32_t)packed.size());
+    put_u32(*data, crc32c(packed.data(), packed.size()));
+    data->append(packed);
+    io.write(fd, offset, data, [this](bool ok) {if (!ok) {failed = true;}});
+    offset += data->size();
+}
+
+uint64_t InputRecorder::sequence()
+{
+    return next_sequence.fetch_add(1, memory_order_relaxed);
+}
+
+void InputRecorder::create(PetId id, const PasoChan& pet)
+{
+    if (!active) {return;}
+    RcuReader reader;
+    string& event = start_event(sequence(), INPUT_CREATE);
+    put_varint(event, id);
+    PetSchema::serialize(pet.get_packed(), event);
+    span<const pmr::string> owners = pet.get_owners();
+    put_varint(event, owners.size());
+    for (const pmr::string& owner : owners) {put_text(event, owner);}
+    stage(id, event);
+}
+
+void InputRecorder::remove(PetId id)
+{
+    if (!active) {return;}
+    string& event = start_event(sequence(), INPUT_REMOVE);
+    put_varint(event, id);
+    stage(id, event);
+}
+
+void InputRecorder::action(uint64_t seq, PetId id, const Action& action)
+{
+    if (!active) {return;}
+    string& event = start_event(seq, INPUT_ACTION);
+    put_varint(event, id);
+    put_deltas(event, action.health, action.hunger, action.happiness, action.stress);
+    stage(id, event);
+}
+
+void InputRecorder::action_fixed(uint64_t seq, PetId id, const FixedAction& action)
+{
+    if (!active) {return;}
+    string& event = start_event(seq, INPUT_ACTION_FIXED);
+    put_varint(event, id);
+    put_deltas(event, action.health, action.hunger, action.happiness, action.stress);
+    stage(id, event);
+}
+
+void InputRecorder::add_owner(uint64_t seq, PetId id, string_view owner)
+{
+    if (!active) {return;}
+    string& event = start_event(seq, INPUT_ADD_OWNER);
+    put_varint(event, id);
+    put_text(event, owner);
+    stage(id, event);
+}
+
+void InputRecorder::remove_owner(uint64_t seq, PetId id, string_view owner)
+{
+    if (!active) {return;}
+    string& event = start_event(seq, INPUT_REMOVE_OWNER);
+    put_varint(event, id);
+    put_text(event, owner);
+    stage(id, event);
+}
+
+void InputRecorder::tick()
+{
+    if (!active) {return;}
+    stage(0, start_event(sequence(), INPUT_TICK));
+}
+
+void InputRecorder::engine(SimTime period, const FixedAction& decay)
+{
+    if (!active) {return;}
+    string& event = start_event(sequence(), INPUT_ENGINE);
+    put_varint(event, period);
+    put_deltas(event, decay.health, decay.hunger, decay.happiness, decay.stress);
+    stage(0, event);
+}
+
+void InputRecorder::message(string_view payload)
+{
+    if (!active) {return;}
+    string& event = start_event(sequence(), INPUT_MESSAGE);
+    put_text(event, payload);
+    stage(0, event);
+}
+
+void InputRecorder::flush()
+{
+    lock_guard<mutex> guard(lock);
+    if (fd < 0) {return;}
+    merge(false);
+    write_block();
+}
+
+uint64_t InputRecorder::event_count() const
+{
+    return events;
+}
+
+InputReader::InputReader()
+{
+    last_time = 0;
+    damaged = false;
+}
+
+bool InputReader::open(const string& path)
+{
+    in.open(path, ios::binary);
+    if (!in)
+    {
+        cout << "Could not open input log " << path << endl;
+        return false;
+    }
+
+    char header[HEADER_SIZE];
+    in.read(header, HEADER_SIZE);
+    string_view view(header, in.gcount());
+    string_view magic;
+    uint32_t version;
+    uint32_t schema;
+    if (!get_bytes(view, sizeof(MAGIC), magic) || magic != string_view(MAGIC, sizeof(MAGIC))
+        || !get_u32(view, version) || version != VERSION
+        || !get_u32(view, schema) || schema != PetSchema::fingerprint())
+    {
+        cout << "Input log " << path << " has a bad header" << endl;
+        return false;
+    }
+
+    contents.clear();
+    rest = string_view();
+    last_time = 0;
+    names.clear();
+    damaged = false;
+    return true;
+}
+
+bool InputReader::next_block()
+{
+    //a block cut short is where recording stopped
+    char header[8];
+    in.read(header, sizeof(header));
+    if (in.gcount() < (streamsize)sizeof(header)) {return false;}
+    string_view view(header, sizeof(header));
+    uint32_t size;
+    uint32_t crc;
+    get_u32(view, size);
+    get_u32(view, crc);
+    if (size > MAX_PACKED_BYTES)
+    {
+        damaged = true;
+        return false;
+    }
+
+    string packed(size, '\0');
+    in.read(packed.data(), size);
+    if (in.gcount() < (streamsize)size) {return false;}
+
+    contents.clear();
+    if (crc32c(packed.data(), packed.size()) != crc || !decompress(packed, contents))
+    {
+        damaged = true;
+        return false;
+    }
+    rest = contents;
+    return true;
+}
+
+bool InputReader::get_name(string_view& name)
+{
+    uint64_t index;
+    if (!get_varint(rest, index)) {return false;}
+    if (index > 0)
+    {
+        if (index > names.size()) {return false;}
+        name = names[index - 1];
+        return true;
+    }
+
+    uint64_t size;
+    string_view bytes;
+    if (!get_varint(rest, size) || !get_bytes(rest, size, bytes)) {return false;}
+    names.emplace_back(bytes);
+    name = names.back();
+    return true;
+}
+
+bool InputReader::next(InputEvent& event)
+{
+    while (rest.empty())
+    {
+        if (!next_block()) {return false;}
+    }
+
+    uint64_t delta;
+    uint8_t kind;
+    if (!get_varint(rest, delta) || !get_u8(rest, kind) || kind >= INPUT_KIND_COUNT)
+    {
+        damaged = true;
+        return false;
+    }
+    last_time += unzigzag(delta);
+    event.time = last_time;
+    event.kind = (InputKind)kind;
+    event.pet = 0;
+    event.action = Action();
+    event.fixed = FixedAction();
+    event.period = 0;
+    event.stats = 0;
+    event.owners.clear();
+    event.text = string_view();
+
+    uint64_t size;
+    bool ok = true;
+    switch (event.kind)
+    {
+        case INPUT_CREATE:
+            //every name takes at least a byte, so a count past that is damage
+            ok = get_varint(rest, event.pet) && PetSchema::deserialize(rest, event.stats)
+                 && get_varint(rest, size) && size <= rest.size();
+            for (uint64_t i = 0; ok && i < size; i++)
+            {
+                string_view name;
+                ok = get_name(name);
+                event.owners.push_back(name);
+            }
+            break;
+        case INPUT_ADD_OWNER: case INPUT_REMOVE_OWNER: ok = get_varint(rest, event.pet) && get_name(event.text); break;
+        case INPUT_REMOVE: ok = get_varint(rest, event.pet); break;
+        case INPUT_ACTION: ok = get_varint(rest, event.pet) && get_deltas(rest, event.action); break;
+        case INPUT_ACTION_FIXED: ok = get_varint(rest, event.pet) && get_deltas(rest, event.fixed); break;
+        case INPUT_ENGINE: ok = get_varint(rest, event.period) && get_deltas(rest, event.fixed); break;
+        case INPUT_MESSAGE: ok = get_varint(rest, size) && get_bytes(rest, size, event.text); break;
+        default: break;
+    }
+    if (!ok) {damaged = true;}
+    return ok;
+}
+
+bool InputReader::is_damaged() const
+{
+    return damaged;
+}
+
+ReplayDriver::ReplayDriver(PetRegistry& registry, const PetHooks* hooks, pmr::memory_resource* resource)
+    : registry(registry), hooks(hooks), resource(resource)
+{
+    engine = nullptr;
+    pool = nullptr;
+}
+
+void ReplayDriver::set_engine(TickEngine* tick_engine, PetPool* tick_pool)
+{
+    engine = tick_engine;
+    pool = tick_pool;
+    if (pool == nullptr) {return;}
+    registry.for_each([&](PetId id, const PetHandle& pet)
+    {
+        if (slots.count(id) == 0) {slots[id] = pool->add(pet);}
+    });
+}
+
+void ReplayDriver::set_messages(function<void(string_view)> handler)
+{
+    on_message = std::move(handler);
+}
+
+void ReplayDriver::apply(const InputEvent& event, ReplayStats& stats)
+{
+    if (event.kind == INPUT_TICK)
+    {
+        if (engine == nullptr) {return;}
+        engine->tick();
+        stats.ticks++;
+        return;
+    }
+    if (event.kind == INPUT_ENGINE)
+    {
+        if (engine == nullptr) {return;}
+        engine->set_period(event.period);
+        engine->set_fixed_decay(event.fixed);
+        return;
+    }
+    if (event.kind == INPUT_MESSAGE)
+    {
+        if (on_message) {on_message(event.text);}
+        return;
+    }
+    if (event.kind == INPUT_CREATE)
+    {
+        PetRecord record{event.pet, event.stats, event.time, vector<string>(event.owners.begin(), event.owners.end()), {}};
+        PetHandle pet = restore_pet(record, resource);
+        if (!pet || !registry.insert(event.pet, pet))
+        {
+            stats.skipped++;
+            return;
+        }
+        pet->attach(event.pet, hooks);
+        if (pool != nullptr) {slots[event.pet] = pool->add(pet);}
+        return;
+    }
+
+    PetHandle pet = registry.find(event.pet);
+    if (!pet)
+    {
+        stats.skipped++;
+        return;
+    }
+    if (event.kind == INPUT_REMOVE)
+    {
+        pet->detach();
+        registry.erase(event.pet);
+        auto slot = slots.find(event.pet);
+        if (slot != slots.end())
+        {
+            pool->remove(slot->second);
+            slots.erase(slot);
+        }
+        return;
+    }
+    switch (event.kind)
+    {
+        case INPUT_ACTION: pet->apply(event.action); break;
+        case INPUT_ACTION_FIXED: pet->apply_fixed(event.fixed); break;
+        case INPUT_ADD_OWNER: pet->add_owner(event.text); break;
+        case INPUT_REMOVE_OWNER: pet->remove_owner(event.text); break;
+        default: break;
+    }
+}
+
+ReplayStats ReplayDriver::run(const string& path)
+{
+    ReplayStats stats = {0, 0, 0, false, 0.0};
+    InputReader reader;
+    if (!reader.open(path)) {return stats;}
+
+    auto start = chrono::steady_clock::now();
+    InputEvent event;
+    while (reader.next(event))
+    {
+        sim_set(event.time);
+        apply(event, stats);
+        stats.events++;
+    }
+    stats.complete = !reader.is_damaged();
+    stats.elapsed_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    return stats;
+}
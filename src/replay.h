@@ -0,0 +1,208 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "clock.h"
+#include "ioqueue.h"
+#include "pasochan.h"
+#include "pool.h"
+#include "registry.h"
+#include "tick.h"
+
+//every kind of input the pet core takes from outside
+enum InputKind : uint8_t
+{
+    INPUT_CREATE,
+    INPUT_REMOVE,
+    INPUT_ACTION,
+    INPUT_ADD_OWNER,
+    INPUT_REMOVE_OWNER,
+    INPUT_TICK,
+    INPUT_MESSAGE,          //an opaque relay message
+    INPUT_ACTION_FIXED,
+    INPUT_ENGINE,           //tick period and decay
+    INPUT_KIND_COUNT
+};
+
+struct InputEvent
+{
+    SimTime time;
+    InputKind kind;
+    PetId pet;
+    Action action;
+    FixedAction fixed;      //fixed point action, or the engine's decay
+    SimTime period;
+    StatWord stats;         //a created pet's stats
+    vector<string_view> owners;     //a created pet's owners
+    string_view text;       //owner name, or message payload
+};
+
+//captures the inputs to the pet core, in the order they are recorded,
+//into a compact log that ReplayDriver can feed back. Once it is open,
+//set it as PetHooks::inputs and with TickEngine::set_recorder(): attached
+//pets record their actions and owner changes, PetResidency records pets
+//added and removed, and the engine records its ticks and settings.
+//Recording should start right after a snapshot, which replay starts from.
+//Each event is
+//stamped with sim_now() rather than wall time. Events are packed as
+//varints (times as deltas, owner names as an index once seen) into
+//blocks that are compressed, checksummed and written through an IoQueue,
+//so recording never waits on the disk:
+//  header: magic, version, schema fingerprint
+//  block: u32 packed length, u32 crc of the packed bytes, compressed events
+//Recording is thread safe. Events are staged per shard of pets, so threads
+//recording different pets rarely contend, and the log is in the order of
+//their sequence numbers. A pet takes the number for one of its changes
+//inside its own lock (see sequence()), so the log has each pet's changes
+//in the order they were made.
+class InputRecorder
+{
+private:
+    static const size_t SHARD_BITS = 4;
+    static const size_t SHARD_COUNT = size_t(1) << SHARD_BITS;
+
+    //events recorded but not yet in the block, each length prefixed:
+    //sequence number, time, kind, then its fields with names spelled out
+    struct alignas(64) Shard
+    {
+        mutex lock;
+        string staged;
+    };
+
+    Shard shards[SHARD_COUNT];
+    atomic<uint64_t> next_sequence;
+    atomic<size_t> staged_bytes;
+    atomic<uint64_t> events;
+    atomic<bool> active;
+
+    //the rest is under lock
+    mutable mutex lock;
+    int fd;
+    uint64_t offset;
+    uint64_t expected;                      //sequence number the block takes next
+    string held;                            //staged events waiting on an earlier one
+    string block;                           //events not yet written
+    SimTime last_time;
+    unordered_map<string, uint32_t> names;
+    atomic<bool> failed;
+    IoQueue io;                             //last, so it drains first
+
+    void stage(PetId key, const string& event);
+    void merge(bool all);
+    void commit(string_view event);
+    void put_name(string_view name);
+    void write_block();
+
+public:
+    InputRecorder();
+    ~InputRecorder();
+
+    InputRecorder(const InputRecorder&) = delete;
+    InputRecorder& operator=(const InputRecorder&) = delete;
+
+    bool open(const string& path);
+    //writes out what is buffered and syncs the log, false if any of it
+    //could not be written
+    bool close();
+
+    //the place in the log of the next change, for the pet changes below.
+    //Take it where the change itself is serialised and record the change
+    //with it afterwards, outside any lock.
+    uint64_t sequence();
+
+    //the pet as it is when it is added, stats and owners
+    void create(PetId id, const PasoChan& pet);
+    void remove(PetId id);
+    void action(uint64_t seq, PetId id, const Action& action);
+    void action_fixed(uint64_t seq, PetId id, const FixedAction& action);
+    void add_owner(uint64_t seq, PetId id, string_view owner);
+    void remove_owner(uint64_t seq, PetId id, string_view owner);
+    //recorded as a tick starts, before it moves the clock, so replay can
+    //set the clock to the recorded time and run the tick the same way
+    void tick();
+    void engine(SimTime period, const FixedAction& decay);
+    void message(string_view payload);
+
+    //hands the buffered events to the disk without waiting
+    void flush();
+
+    uint64_t event_count() const;
+};
+
+//reads a log written by InputRecorder one event at a time, a block at a
+//time. A torn block at the end, as left by a crash, ends the log quietly.
+class InputReader
+{
+private:
+    ifstream in;
+    string contents;                        //the current block, decompressed
+    string_view rest;
+    SimTime last_time;
+    deque<string> names;                    //deque so the views stay put
+    bool damaged;
+
+    bool next_block();
+    bool get_name(string_view& name);
+
+public:
+    InputReader();
+
+    bool open(const string& path);
+
+    //false at the end of the log or where it is damaged. A message
+    //payload is valid until the next call, owner names until the reader
+    //goes away. event.owners is reused, so pass the same event each call.
+    bool next(InputEvent& event);
+
+    //true if reading stopped at a damaged block rather than the end
+    bool is_damaged() const;
+};
+
+struct ReplayStats
+{
+    uint64_t events;
+    uint64_t ticks;
+    uint64_t skipped;           //events for pets that did not exist, or creates of ones that did
+    bool complete;              //false if the log was damaged
+    double elapsed_ms;
+};
+
+//feeds a recorded log back into the pet core as fast as it will go, on
+//the calling thread, for benchmarks and profiling against real traffic.
+//The sim clock is set to each event's time before it is applied, so
+//anything stamped with sim_now() comes out as it did when recorded, and
+//ticks run the engine from the time they started at.
+//The registry should start out as it was when recording started, i.e.
+//loaded from the snapshot taken then, and the engine should have the
+//rules it had; its period and decay come from the log.
+class ReplayDriver
+{
+private:
+    PetRegistry& registry;
+    const PetHooks* hooks;
+    pmr::memory_resource* resource;
+    TickEngine* engine;
+    PetPool* pool;
+    unordered_map<PetId, PetSlot> slots;
+    function<void(string_view)> on_message;
+
+    void apply(const InputEvent& event, ReplayStats& stats);
+
+public:
+    ReplayDriver(PetRegistry& registry, const PetHooks* hooks = nullptr,
+                 pmr::memory_resource* resource = pmr::get_default_resource());
+
+    //puts the pets already registered into pool, as are pets the log
+    //creates, and tick events run engine (which moves the clock itself).
+    //Without an engine ticks are skipped.
+    void set_engine(TickEngine* tick_engine, PetPool* tick_pool);
+    //relay messages go to handler, and are skipped without one
+    void set_messages(function<void(string_view)> handler);
+
+    ReplayStats run(const string& path);
+};
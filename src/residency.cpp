@@ -0,0 +1,422 @@
+#include "residency.h"
+#include "owners.h"
+#include "replay.h"
+#include "risk.h"
+#include "snapshot.h"
+#include <climits>
+
+//the window takes 1% of the budget, protected pets 80% of the rest
+static const size_t WINDOW_PERCENT = 1;
+static const size_t PROTECTED_PERCENT = 80;
+//rough size of a pet, used to size the sketch
+static const size_t TYPICAL_PET_BYTES = 256;
+//decay catch-up is capped, stats have long since hit their limits by then
+static const SimTime MAX_CATCHUP_PERIODS = 1000;
+
+//decay over several periods, saturating rather than wrapping
+static int catch_up(int per_period, int periods)
+{
+    return (int)clamp((int64_t)per_period * periods, (int64_t)INT_MIN, (int64_t)INT_MAX);
+}
+
+static uint64_t mix(PetId id)
+{
+    //splitmix64 finalizer
+    uint64_t x = id;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+PetResidency::Sketch::Sketch(size_t expected_pets)
+{
+    //one 64-bit word holds sixteen counters, aim for about 16 counters per pet
+    size_t words = 64;
+    while (words < expected_pets) {words *= 2;}
+    table.assign(words, 0);
+    mask = words - 1;
+    additions = 0;
+    sample_size = 10 * max<size_t>(expected_pets, 64);
+}
+
+void PetResidency::Sketch::increment(PetId id)
+{
+    uint64_t h = mix(id);
+    uint64_t step = (h >> 32) | 1;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t& word = table[(h + i * step) & mask];
+        int shift = (int)((h >> (8 + 4 * i)) & 15) * 4;
+        if ((word >> shift & 15) < 15) {word += uint64_t(1) << shift;}
+    }
+
+    //age every counter once enough has been counted
+    if (++additions >= sample_size)
+    {
+        for (uint64_t& word : table) {word = (word >> 1) & 0x7777777777777777ULL;}
+        additions /= 2;
+    }
+}
+
+int PetResidency::Sketch::frequency(PetId id) const
+{
+    uint64_t h = mix(id);
+    uint64_t step = (h >> 32) | 1;
+    int lowest = 15;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t word = table[(h + i * step) & mask];
+        int shift = (int)((h >> (8 + 4 * i)) & 15) * 4;
+        lowest = min(lowest, (int)(word >> shift & 15));
+    }
+    return lowest;
+}
+
+PetResidency::PetResidency(PetRegistry& registry, PetStore& store, size_t budget_bytes, pmr::memory_resource* resource)
+    : registry(registry), store(store), resource(resource), sketch(budget_bytes / TYPICAL_PET_BYTES)
+{
+    hooks = nullptr;
+    period = 0;
+    for (size_t& bytes : used) {bytes = 0;}
+    budget = budget_bytes;
+    window_budget = max<size_t>(budget * WINDOW_PERCENT / 100, TYPICAL_PET_BYTES);
+    protected_budget = (budget - min(budget, window_budget)) * PROTECTED_PERCENT / 100;
+    hits = 0;
+    faults = 0;
+    evictions = 0;
+}
+
+void PetResidency::set_hooks(const PetHooks* pet_hooks)
+{
+    lock_guard<mutex> guard(lock);
+    hooks = pet_hooks;
+}
+
+void PetResidency::set_decay(const Action& per_period, SimTime period_ms)
+{
+    set_fixed_decay(to_fixed(per_period), period_ms);
+}
+
+void PetResidency::set_fixed_decay(const FixedAction& per_period, SimTime period_ms)
+{
+    lock_guard<mutex> guard(lock);
+    decay = per_period;
+    period = period_ms;
+}
+
+size_t PetResidency::footprint(const PasoChan& pet)
+{
+    //the pet, its shared_ptr control block and its owner list
+    size_t bytes = sizeof(PasoChan) + 32;
+    for (const pmr::string& owner : pet.get_owners())
+    {
+        bytes += sizeof(pmr::string) + owner.capacity() + 1;
+    }
+    return bytes;
+}
+
+size_t PetResidency::total() const
+{
+    return used[WINDOW] + used[PROBATION] + used[PROTECTED];
+}
+
+void PetResidency::move_to(list<Node>::iterator node, Region region)
+{
+    used[node->region] -= node->bytes;
+    queues[region].splice(queues[region].begin(), queues[node->region], node);
+    node->region = region;
+    used[region] += node->bytes;
+}
+
+void PetResidency::record_access(PetId id)
+{
+    sketch.increment(id);
+    auto found = nodes.find(id);
+    if (found == nodes.end()) {return;}
+
+    list<Node>::iterator node = found->second;
+    if (node->region != PROBATION)
+    {
+        move_to(node, node->region);
+        return;
+    }
+
+    //a second hit while on probation earns a protected place, pushing the
+    //least recent protected pets back onto probation
+    move_to(node, PROTECTED);
+    while (used[PROTECTED] > protected_budget && queues[PROTECTED].size() > 1)
+    {
+        move_to(prev(queues[PROTECTED].end()), PROBATION);
+    }
+}
+
+void PetResidency::admit(PetId id, const PasoChan& pet)
+{
+    if (nodes.count(id) != 0)
+    {
+        record_access(id);
+        return;
+    }
+
+    sketch.increment(id);
+    queues[WINDOW].push_front(Node{id, footprint(pet), WINDOW});
+    nodes[id] = queues[WINDOW].begin();
+    used[WINDOW] += queues[WINDOW].front().bytes;
+}
+
+bool PetResidency::evict(list<Node>::iterator node)
+{
+    PetId id = node->id;
+    PetHandle pet = registry.find(id);
+    if (pet)
+    {
+        //taking it out of the registry first means nobody new can pick it
+        //up, anyone who already has it pins it
+        if (pet.use_count() > 2 || !registry.erase(id)) {return false;}
+        if (pet.use_count() > 1)
+        {
+            registry.insert(id, pet);
+            return false;
+        }
+
+        if (!store.put(capture_pet(id, *pet, nullptr)))
+        {
+            registry.insert(id, pet);
+            return false;
+        }
+        suspended[id] = pet->suspend();
+        evictions++;
+    }
+
+    used[node->region] -= node->bytes;
+    queues[node->region].erase(node);
+    nodes.erase(id);
+    return true;
+}
+
+void PetResidency::enforce_budget()
+{
+    //pets overflowing the window move on to probation
+    while (used[WINDOW] > window_budget && queues[WINDOW].size() > 1)
+    {
+        move_to(prev(queues[WINDOW].end()), PROBATION);
+    }
+
+    size_t pinned = 0;
+    while (total() > budget && pinned < nodes.size())
+    {
+        list<Node>::iterator victim;
+        if (!queues[PROBATION].empty())
+        {
+            //the newest arrival on probation only stays if it is more
+            //popular than the pet that has been there longest
+            victim = prev(queues[PROBATION].end());
+            list<Node>::iterator candidate = queues[PROBATION].begin();
+            if (candidate != victim && sketch.frequency(candidate->id) <= sketch.frequency(victim->id))
+            {
+                victim = candidate;
+            }
+        }
+        else if (!queues[PROTECTED].empty()) {victim = prev(queues[PROTECTED].end());}
+        else {victim = prev(queues[WINDOW].end());}
+
+        if (!evict(victim))
+        {
+            //pinned, treat it as just used and try someone else
+            move_to(victim, victim->region);
+            pinned++;
+        }
+    }
+}
+
+bool PetResidency::add(PetId id, PetHandle pet)
+{
+    lock_guard<mutex> guard(lock);
+    if (!registry.insert(id, pet)) {return false;}
+    //recorded before the pet is attached, so its create comes before any
+    //change it records in the log
+    if (hooks != nullptr && hooks->inputs != nullptr) {hooks->inputs->create(id, *pet);}
+    pet->attach(id, hooks);
+    admit(id, *pet);
+    enforce_budget();
+    return true;
+}
+
+void PetResidency::track_registered()
+{
+    lock_guard<mutex> guard(lock);
+    registry.for_each([&](PetId id, const PetHandle& pet)
+    {
+        if (nodes.count(id) == 0) {admit(id, *pet);}
+    });
+    enforce_budget();
+}
+
+PetHandle PetResidency::acquire(PetId id)
+{
+    PetHandle pet = registry.find(id);
+    if (pet)
+    {
+        //a busy policy lock just means this access goes uncounted
+        unique_lock<mutex> guard(lock, try_to_lock);
+        if (guard.owns_lock()) {record_access(id);}
+        hits++;
+        return pet;
+    }
+
+    unique_lock<mutex> guard(lock);
+    pet = registry.find(id);
+    if (pet)
+    {
+        record_access(id);
+        hits++;
+        return pet;
+    }
+
+    //someone is already reading this pet in, theirs is the one to share
+    auto busy = loading.find(id);
+    if (busy != loading.end())
+    {
+        shared_ptr<Loading> load = busy->second;
+        loaded.wait(guard, [&] {return load->done;});
+        if (load->pet) {record_access(id);}
+        return load->pet;
+    }
+
+    //the store read, decoding and catch-up run without the lock, so
+    //faults of different pets overlap and hits are not held up
+    auto load = make_shared<Loading>();
+    loading.emplace(id, load);
+    FixedAction missed = decay;
+    SimTime missed_period = period;
+    guard.unlock();
+
+    PetRecord record;
+    if (store.get(id, record)) {pet = restore_pet(record, resource);}
+    SimTime now = sim_now();
+    if (pet && missed_period > 0 && now > record.saved_at)
+    {
+        int periods = (int)min((now - record.saved_at) / missed_period, MAX_CATCHUP_PERIODS);
+        //in fixed point the fractions missed each period add up exactly
+        pet->apply_fixed_derived(FixedAction{.health = catch_up(missed.health, periods),
+                                             .hunger = catch_up(missed.hunger, periods),
+                                             .happiness = catch_up(missed.happiness, periods),
+                                             .stress = catch_up(missed.stress, periods)});
+    }
+
+    guard.lock();
+    loading.erase(id);
+    if (pet && !load->removed && registry.insert(id, pet))
+    {
+        SuspendedPet saved;
+        auto parked = suspended.find(id);
+        if (parked != suspended.end())
+        {
+            saved = parked->second;
+            suspended.erase(parked);
+        }
+
+        pet->resume(id, hooks, saved);
+        admit(id, *pet);
+        faults++;
+        enforce_budget();
+    }
+    //removed while it was being read, or added again meanwhile
+    else if (pet) {pet = load->removed ? PetHandle() : registry.find(id);}
+
+    load->pet = pet;
+    load->done = true;
+    loaded.notify_all();
+    return pet;
+}
+
+bool PetResidency::remove(PetId id)
+{
+    lock_guard<mutex> guard(lock);
+    PetHandle pet = registry.find(id);
+    bool found = pet != nullptr;
+    if (!found)
+    {
+        //a paged out pet is still in the owner index, unlink it by the
+        //owners it was saved with rather than loading it back
+        PetRecord record;
+        found = store.get(id, record);
+        if (found && hooks != nullptr && hooks->owners != nullptr)
+        {
+            for (const string& name : record.owners)
+            {
+                OwnerId owner = hooks->owners->lookup(name);
+                if (owner != OwnerIndex::NO_OWNER) {hooks->owners->unlink(owner, id);}
+            }
+        }
+    }
+
+    //a fault-in still reading the pet drops it rather than bring it back
+    auto busy = loading.find(id);
+    if (busy != loading.end()) {busy->second->removed = true;}
+
+    //and in the risk index
+    auto parked = suspended.find(id);
+    if (parked != suspended.end())
+    {
+        if (hooks != nullptr && hooks->risk != nullptr) {hooks->risk->remove(parked->second.risk_entry);}
+        suspended.erase(parked);
+    }
+
+    registry.erase(id);
+    store.erase(id);
+    if (found && hooks != nullptr && hooks->inputs != nullptr) {hooks->inputs->remove(id);}
+
+    auto node = nodes.find(id);
+    if (node != nodes.end())
+    {
+        used[node->second->region] -= node->second->bytes;
+        queues[node->second->region].erase(node->second);
+        nodes.erase(node);
+    }
+    return found;
+}
+
+void PetResidency::evict_all()
+{
+    lock_guard<mutex> guard(lock);
+    for (list<Node>& queue : queues)
+    {
+        for (auto node = queue.begin(); node != queue.end();)
+        {
+            auto next = std::next(node);
+            evict(node);
+            node = next;
+        }
+    }
+}
+
+size_t PetResidency::resident() const
+{
+    lock_guard<mutex> guard(lock);
+    return nodes.size();
+}
+
+size_t PetResidency::resident_bytes() const
+{
+    lock_guard<mutex> guard(lock);
+    return total();
+}
+
+uint64_t PetResidency::hit_count() const
+{
+    return hits;
+}
+
+uint64_t PetResidency::fault_count() const
+{
+    return faults;
+}
+
+uint64_t PetResidency::eviction_count() const
+{
+    return evictions;
+}
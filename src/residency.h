@@ -0,0 +1,134 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "clock.h"
+#include "pasochan.h"
+#include "registry.h"
+#include "store.h"
+
+//keeps the pets that are actually being used in the registry, within a
+//byte budget, and pages the rest out to a PetStore. Eviction follows
+//W-TinyLFU: new pets enter a small LRU window, and a pet leaving the
+//window only displaces the coldest pet of the main area if it has been
+//seen more often recently (by a count-min sketch), so one pass over many
+//idle pets cannot flush out the regulars. Pets faulted back in catch up
+//on the decay they missed while they were out.
+//
+//Paged out pets stay listed in the hooks' owner index and risk index
+//(with their last stats), and keep their alert latches.
+//
+//A pet whose handle is held anywhere else (e.g. by a PetPool being
+//ticked) is pinned and never evicted.
+class PetResidency
+{
+private:
+    enum Region : uint8_t { WINDOW, PROBATION, PROTECTED, REGION_COUNT };
+
+    struct Node
+    {
+        PetId id;
+        size_t bytes;
+        Region region;
+    };
+
+    //approximate access counts, 4-bit counters halved every so often so
+    //the counts follow what is popular now
+    class Sketch
+    {
+    private:
+        vector<uint64_t> table;
+        uint64_t mask;
+        size_t additions;
+        size_t sample_size;
+
+    public:
+        explicit Sketch(size_t expected_pets);
+        void increment(PetId id);
+        int frequency(PetId id) const;
+    };
+
+    PetRegistry& registry;
+    PetStore& store;
+    pmr::memory_resource* resource;
+    const PetHooks* hooks;
+    FixedAction decay;
+    SimTime period;
+
+    //a pet being faulted in, read from the store with lock released.
+    //Others acquiring the same id wait on loaded for the result.
+    struct Loading
+    {
+        bool done = false;
+        bool removed = false;               //remove() ran meanwhile
+        PetHandle pet;
+    };
+
+    mutable mutex lock;
+    condition_variable loaded;
+    unordered_map<PetId, shared_ptr<Loading>> loading;
+    list<Node> queues[REGION_COUNT];        //front is most recent
+    unordered_map<PetId, list<Node>::iterator> nodes;
+    //what each paged out pet left in the hooks
+    unordered_map<PetId, SuspendedPet> suspended;
+    size_t used[REGION_COUNT];
+    size_t budget;
+    size_t window_budget;
+    size_t protected_budget;
+    Sketch sketch;
+
+    atomic<uint64_t> hits;
+    atomic<uint64_t> faults;
+    atomic<uint64_t> evictions;
+
+    static size_t footprint(const PasoChan& pet);
+    size_t total() const;
+    void move_to(list<Node>::iterator node, Region region);
+    void record_access(PetId id);
+    void admit(PetId id, const PasoChan& pet);
+    bool evict(list<Node>::iterator node);
+    void enforce_budget();
+
+public:
+    PetResidency(PetRegistry& registry, PetStore& store, size_t budget_bytes,
+                 pmr::memory_resource* resource = pmr::get_default_resource());
+
+    PetResidency(const PetResidency&) = delete;
+    PetResidency& operator=(const PetResidency&) = delete;
+
+    //hooks given to pets added or faulted in, may be nullptr
+    void set_hooks(const PetHooks* pet_hooks);
+    //decay a pet takes per period, applied on fault-in for the time it was out
+    void set_decay(const Action& per_period, SimTime period_ms);
+    void set_fixed_decay(const FixedAction& per_period, SimTime period_ms);
+
+    //registers a new pet and starts tracking it, recorded as created if
+    //the hooks have an InputRecorder
+    bool add(PetId id, PetHandle pet);
+    //starts tracking pets that were put in the registry directly, e.g. by
+    //load_snapshot()
+    void track_registered();
+
+    //the pet, faulted in from the store if it was paged out, or an empty
+    //handle if it is in neither. The store is read without the policy
+    //lock; concurrent acquires of the same pet wait for the one read.
+    PetHandle acquire(PetId id);
+
+    //deletes the pet from memory and storage, recorded as removed if the
+    //hooks have an InputRecorder
+    bool remove(PetId id);
+
+    //pages out every tracked pet that is not pinned, e.g. before shutdown
+    void evict_all();
+
+    size_t resident() const;
+    size_t resident_bytes() const;
+    uint64_t hit_count() const;
+    uint64_t fault_count() const;
+    uint64_t eviction_count() const;
+};
@@ -0,0 +1,135 @@
+#include "risk.h"
+
+static int clamp_bucket(int value)
+{
+    if (value < 0) {return 0;}
+    if (value > 100) {return 100;}
+    return value;
+}
+
+RiskIndex::RiskIndex()
+{
+    next_shard.store(0, memory_order_relaxed);
+    for (Shard& shard : shards)
+    {
+        for (int s = 0; s < STAT_COUNT; s++)
+        {
+            for (int b = 0; b < BUCKETS; b++) {shard.heads[s][b] = NIL;}
+        }
+    }
+}
+
+void RiskIndex::link(Shard& shard, uint32_t local, int stat, int bucket)
+{
+    Node& node = shard.nodes[local];
+    node.bucket[stat] = (uint8_t)bucket;
+    node.prev[stat] = NIL;
+    node.next[stat] = shard.heads[stat][bucket];
+    if (node.next[stat] != NIL) {shard.nodes[node.next[stat]].prev[stat] = local;}
+    shard.heads[stat][bucket] = local;
+}
+
+void RiskIndex::unlink(Shard& shard, uint32_t local, int stat)
+{
+    Node& node = shard.nodes[local];
+    if (node.prev[stat] != NIL) {shard.nodes[node.prev[stat]].next[stat] = node.next[stat];}
+    else {shard.heads[stat][node.bucket[stat]] = node.next[stat];}
+    if (node.next[stat] != NIL) {shard.nodes[node.next[stat]].prev[stat] = node.prev[stat];}
+}
+
+uint32_t RiskIndex::add(PetId pet, const Stats& stats)
+{
+    uint32_t s = next_shard.fetch_add(1, memory_order_relaxed) & (SHARD_COUNT - 1);
+    Shard& shard = shards[s];
+    lock_guard<mutex> guard(shard.lock);
+
+    uint32_t local;
+    if (!shard.free_nodes.empty())
+    {
+        local = shard.free_nodes.back();
+        shard.free_nodes.pop_back();
+    }
+    else
+    {
+        local = (uint32_t)shard.nodes.size();
+        shard.nodes.emplace_back();
+    }
+
+    shard.nodes[local].pet = pet;
+    shard.nodes[local].live = true;
+    int values[STAT_COUNT] = {stats.health, stats.hunger, stats.happiness, stats.stress};
+    for (int stat = 0; stat < STAT_COUNT; stat++)
+    {
+        link(shard, local, stat, clamp_bucket(values[stat]));
+    }
+    shard.live++;
+    return local << SHARD_BITS | s;
+}
+
+void RiskIndex::remove(uint32_t entry)
+{
+    Shard& shard = shards[entry & (SHARD_COUNT - 1)];
+    uint32_t local = entry >> SHARD_BITS;
+    lock_guard<mutex> guard(shard.lock);
+    if (local >= shard.nodes.size() || !shard.nodes[local].live) {return;}
+
+    for (int stat = 0; stat < STAT_COUNT; stat++) {unlink(shard, local, stat);}
+    shard.nodes[local].live = false;
+    shard.free_nodes.push_back(local);
+    shard.live--;
+}
+
+void RiskIndex::update(uint32_t entry, const PasoChan& pet)
+{
+    Shard& shard = shards[entry & (SHARD_COUNT - 1)];
+    uint32_t local = entry >> SHARD_BITS;
+    lock_guard<mutex> guard(shard.lock);
+    if (local >= shard.nodes.size() || !shard.nodes[local].live) {return;}
+
+    //read the stats under the lock so racing updates settle on the latest value
+    Stats stats = pet.get_stats();
+    int values[STAT_COUNT] = {stats.health, stats.hunger, stats.happiness, stats.stress};
+    for (int stat = 0; stat < STAT_COUNT; stat++)
+    {
+        int bucket = clamp_bucket(values[stat]);
+        if (shard.nodes[local].bucket[stat] == bucket) {continue;}
+        unlink(shard, local, stat);
+        link(shard, local, stat, bucket);
+    }
+}
+
+vector<RiskEntry> RiskIndex::top_k(StatId stat, bool lowest, size_t k)
+{
+    vector<RiskEntry> out;
+    if (stat >= STAT_COUNT || k == 0) {return out;}
+    out.reserve(k);
+
+    //all shards are held so the answer reflects one moment
+    unique_lock<mutex> guards[SHARD_COUNT];
+    for (uint32_t s = 0; s < SHARD_COUNT; s++) {guards[s] = unique_lock<mutex>(shards[s].lock);}
+
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        int bucket = lowest ? i : BUCKETS - 1 - i;
+        for (Shard& shard : shards)
+        {
+            for (uint32_t local = shard.heads[stat][bucket]; local != NIL; local = shard.nodes[local].next[stat])
+            {
+                out.push_back(RiskEntry{shard.nodes[local].pet, bucket});
+                if (out.size() == k) {return out;}
+            }
+        }
+    }
+    return out;
+}
+
+size_t RiskIndex::size()
+{
+    size_t total = 0;
+    for (Shard& shard : shards)
+    {
+        lock_guard<mutex> guard(shard.lock);
+        total += shard.live;
+    }
+    return total;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <mutex>
+#include "pasochan.h"
+
+struct RiskEntry
+{
+    PetId pet;
+    int value;
+};
+
+//"most at risk" index: every attached pet sits in one of 101 buckets per
+//stat (the stat's value), kept current by PasoChan::apply. Top-K walks
+//the buckets from either end, so a query costs O(K + buckets) no matter
+//how many pets there are. Entries are spread over shards so concurrent
+//mutations rarely share a lock.
+class RiskIndex
+{
+private:
+    static const int BUCKETS = 101;
+    static const uint32_t SHARD_BITS = 4;
+    static const uint32_t SHARD_COUNT = 1 << SHARD_BITS;
+    static const uint32_t NIL = ~uint32_t(0);
+
+    struct Node
+    {
+        PetId pet;
+        bool live;
+        uint8_t bucket[STAT_COUNT];
+        uint32_t prev[STAT_COUNT];
+        uint32_t next[STAT_COUNT];
+    };
+
+    struct alignas(64) Shard
+    {
+        mutex lock;
+        vector<Node> nodes;
+        vector<uint32_t> free_nodes;
+        uint32_t heads[STAT_COUNT][BUCKETS];
+        size_t live = 0;
+    };
+
+    Shard shards[SHARD_COUNT];
+    atomic<uint32_t> next_shard;
+
+    static void link(Shard& shard, uint32_t local, int stat, int bucket);
+    static void unlink(Shard& shard, uint32_t local, int stat);
+
+public:
+    static const uint32_t NO_ENTRY = ~uint32_t(0);
+
+    RiskIndex();
+
+    //called by PasoChan on attach/detach/mutation, entries are opaque handles
+    uint32_t add(PetId pet, const Stats& stats);
+    void remove(uint32_t entry);
+    void update(uint32_t entry, const PasoChan& pet);
+
+    //the k pets with the lowest (or highest) value of a stat, ties in no particular order
+    vector<RiskEntry> top_k(StatId stat, bool lowest, size_t k);
+    size_t size();
+};
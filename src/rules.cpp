@@ -0,0 +1,234 @@
+#include "rules.h"
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+//pets are evaluated this many at a time, small enough that the columns stay in L1
+static const size_t BLOCK = 256;
+
+static const char* STAT_NAMES[STAT_COUNT] = {"health", "hunger", "happiness", "stress"};
+
+bool parse_stat(string_view name, StatId& out)
+{
+    for (int i = 0; i < STAT_COUNT; i++)
+    {
+        if (name == STAT_NAMES[i])
+        {
+            out = (StatId)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* stat_name(StatId stat)
+{
+    if (stat >= STAT_COUNT) {return "unknown";}
+    return STAT_NAMES[stat];
+}
+
+static bool parse_op(string_view text, RuleOp& out)
+{
+    if (text == "<") {out = LESS;}
+    else if (text == "<=") {out = LESS_EQUAL;}
+    else if (text == ">") {out = GREATER;}
+    else if (text == ">=") {out = GREATER_EQUAL;}
+    else {return false;}
+    return true;
+}
+
+static bool parse_int(string_view text, int& out)
+{
+    if (!text.empty() && text[0] == '+') {text.remove_prefix(1);}
+    auto result = from_chars(text.data(), text.data() + text.size(), out);
+    return result.ec == errc() && result.ptr == text.data() + text.size();
+}
+
+//splits off the next whitespace separated token
+static string_view next_token(string_view& text)
+{
+    size_t start = text.find_first_not_of(" \t\r");
+    if (start == string_view::npos)
+    {
+        text = string_view();
+        return string_view();
+    }
+    size_t end = text.find_first_of(" \t\r", start);
+    if (end == string_view::npos) {end = text.size();}
+
+    string_view token = text.substr(start, end - start);
+    text.remove_prefix(end);
+    return token;
+}
+
+bool RuleSet::add(const Rule& rule)
+{
+    if (rule.when >= STAT_COUNT || rule.target >= STAT_COUNT || rule.op > GREATER_EQUAL)
+    {
+        cout << "Rule refers to an unknown stat or op" << endl;
+        return false;
+    }
+    if (rule.threshold < INT16_MIN || rule.threshold > INT16_MAX)
+    {
+        cout << "Rule threshold " << rule.threshold << " is out of range" << endl;
+        return false;
+    }
+    if (rule.amount < -INT16_MAX || rule.amount > INT16_MAX || reach[rule.target] + abs(rule.amount) > INT16_MAX)
+    {
+        cout << "Rule amount " << rule.amount << " is out of range for " << stat_name(rule.target) << endl;
+        return false;
+    }
+
+    Instruction ins;
+    ins.when = rule.when;
+    ins.op = rule.op;
+    ins.target = rule.target;
+    ins.threshold = (int16_t)rule.threshold;
+    ins.amount = (int16_t)rule.amount;
+    program.push_back(ins);
+    reach[rule.target] += abs(rule.amount);
+    return true;
+}
+
+bool RuleSet::add(string_view line)
+{
+    size_t comment = line.find('#');
+    if (comment != string_view::npos) {line = line.substr(0, comment);}
+
+    string_view rest = line;
+    string_view tokens[6];
+    int count = 0;
+    for (string_view token = next_token(rest); !token.empty(); token = next_token(rest))
+    {
+        if (count == 6) {count++; break;}
+        tokens[count++] = token;
+    }
+    if (count == 0) {return true;}
+
+    Rule rule;
+    if (count != 6
+        || !parse_stat(tokens[0], rule.when)
+        || !parse_op(tokens[1], rule.op)
+        || !parse_int(tokens[2], rule.threshold)
+        || tokens[3] != "->"
+        || !parse_stat(tokens[4], rule.target)
+        || !parse_int(tokens[5], rule.amount))
+    {
+        cout << "Could not parse rule: " << line << endl;
+        return false;
+    }
+
+    return add(rule);
+}
+
+size_t RuleSet::load(istream& in)
+{
+    size_t failed = 0;
+    string line;
+    while (getline(in, line))
+    {
+        if (!add(string_view(line))) {failed++;}
+    }
+    return failed;
+}
+
+size_t RuleSet::size() const
+{
+    return program.size();
+}
+
+void RuleSet::clear()
+{
+    program.clear();
+    for (int& total : reach) {total = 0;}
+}
+
+static bool test(uint8_t op, int value, int threshold)
+{
+    switch (op)
+    {
+        case LESS: return value < threshold;
+        case LESS_EQUAL: return value <= threshold;
+        case GREATER: return value > threshold;
+        default: return value >= threshold;
+    }
+}
+
+Action RuleSet::evaluate(const Stats& stats) const
+{
+    int values[STAT_COUNT] = {stats.health, stats.hunger, stats.happiness, stats.stress};
+    int deltas[STAT_COUNT] = {0, 0, 0, 0};
+
+    for (const Instruction& ins : program)
+    {
+        if (test(ins.op, values[ins.when], ins.threshold)) {deltas[ins.target] += ins.amount;}
+    }
+    return Action{deltas[HEALTH], deltas[HUNGER], deltas[HAPPINESS], deltas[STRESS]};
+}
+
+//one instruction over a whole block, the op is fixed for the loop so it
+//compiles to compares and selects with no branches per pet
+template <typename Compare>
+static void run_instruction(const uint8_t* values, int16_t* deltas, size_t n, int threshold, int amount, Compare compare)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        deltas[i] += compare(values[i], threshold) ? amount : 0;
+    }
+}
+
+void RuleSet::run(span<PasoChan* const> pets) const
+{
+    if (program.empty()) {return;}
+
+    uint8_t values[STAT_COUNT][BLOCK];
+    int16_t deltas[STAT_COUNT][BLOCK];
+
+    for (size_t begin = 0; begin < pets.size(); begin += BLOCK)
+    {
+        size_t n = min(BLOCK, pets.size() - begin);
+        PasoChan* const* block = pets.data() + begin;
+
+        //gather the stats into columns
+        for (size_t i = 0; i < n; i++)
+        {
+            Stats s = block[i] != nullptr ? block[i]->get_stats() : Stats{0, 0, 0, 0};
+            values[HEALTH][i] = (uint8_t)s.health;
+            values[HUNGER][i] = (uint8_t)s.hunger;
+            values[HAPPINESS][i] = (uint8_t)s.happiness;
+            values[STRESS][i] = (uint8_t)s.stress;
+        }
+        memset(deltas, 0, sizeof(deltas));
+
+        for (const Instruction& ins : program)
+        {
+            const uint8_t* in = values[ins.when];
+            int16_t* out = deltas[ins.target];
+            switch (ins.op)
+            {
+                case LESS: run_instruction(in, out, n, ins.threshold, ins.amount, [](int v, int t) { return v < t; }); break;
+                case LESS_EQUAL: run_instruction(in, out, n, ins.threshold, ins.amount, [](int v, int t) { return v <= t; }); break;
+                case GREATER: run_instruction(in, out, n, ins.threshold, ins.amount, [](int v, int t) { return v > t; }); break;
+                default: run_instruction(in, out, n, ins.threshold, ins.amount, [](int v, int t) { return v >= t; }); break;
+            }
+        }
+
+        //scatter back, pets no rule touched are left alone
+        for (size_t i = 0; i < n; i++)
+        {
+            if (block[i] == nullptr) {continue;}
+            Action action{deltas[HEALTH][i], deltas[HUNGER][i], deltas[HAPPINESS][i], deltas[STRESS][i]};
+            if (action.health == 0 && action.hunger == 0 && action.happiness == 0 && action.stress == 0) {continue;}
+            block[i]->apply_derived(action);
+        }
+    }
+}
+
+void RuleSet::run(const PetPool& pool) const
+{
+    for (size_t c = 0; c < pool.chunk_count(); c++)
+    {
+        run(pool.chunk(c));
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <istream>
+#include "pasochan.h"
+#include "pool.h"
+
+enum RuleOp : uint8_t
+{
+    LESS,
+    LESS_EQUAL,
+    GREATER,
+    GREATER_EQUAL
+};
+
+//"when <stat> <op> <threshold>, change <target> by <amount>", written in
+//rule files as e.g. "stress > 80 -> health -1"
+struct Rule
+{
+    StatId when;
+    RuleOp op;
+    int threshold;
+    StatId target;
+    int amount;
+};
+
+//cross-stat rules compiled into a flat instruction list. Every rule sees
+//the stats from before the pass, so rule order does not matter, and the
+//summed deltas go to each pet as one Action.
+class RuleSet
+{
+private:
+    struct Instruction
+    {
+        uint8_t when;
+        uint8_t op;
+        uint8_t target;
+        int16_t threshold;
+        int16_t amount;
+    };
+
+    vector<Instruction> program;
+    //sum of |amount| per target, kept within int16_t so the per-pet
+    //delta columns cannot wrap however many rules fire
+    int reach[STAT_COUNT] = {0, 0, 0, 0};
+
+public:
+    //returns false and leaves the set unchanged if a stat or op is unknown
+    //or the threshold or amount do not fit the compiled form
+    bool add(const Rule& rule);
+    //parses one rule line, blank lines and "#" comments are accepted and ignored
+    bool add(string_view line);
+    //returns the number of lines that failed to parse
+    size_t load(istream& in);
+
+    size_t size() const;
+    void clear();
+
+    //deltas the rules produce for one set of stats
+    Action evaluate(const Stats& stats) const;
+
+    //runs every rule over the pets (nullptr entries are skipped)
+    void run(span<PasoChan* const> pets) const;
+    void run(const PetPool& pool) const;
+};
+
+bool parse_stat(string_view name, StatId& out);
+const char* stat_name(StatId stat);
@@ -0,0 +1,689 @@
+#include "series.h"
+#include <algorithm>
+#include <filesystem>
+#include "checksum.h"
+#include "codec.h"
+
+static const char MAGIC[8] = {'P', 'A', 'S', 'O', 'T', 'S', 'D', 'B'};
+static const uint32_t VERSION = 1;
+static const size_t FILE_HEADER_SIZE = sizeof(MAGIC) + 4;
+static const int VALUE_BITS = 7;
+
+//pet, first, last, count, (length, crc) per section, header crc
+static const size_t BLOCK_HEADER_SIZE = 8 + 8 + 8 + 4 + 8 * (1 + RESOLUTION_COUNT) + 4;
+
+//fewer samples per bucket than this on average and a block does not
+//store the rollup
+static const uint32_t MIN_BUCKET_SAMPLES = 4;
+
+static const SimTime WIDTHS[RESOLUTION_COUNT] = {60 * 1000, 60 * 60 * 1000, 24 * 60 * 60 * 1000};
+
+double StatRollup::mean(StatId stat) const
+{
+    if (count == 0) {return 0;}
+    return (double)sum[stat] / count;
+}
+
+SimTime SeriesStore::bucket_width(Resolution resolution)
+{
+    return WIDTHS[resolution];
+}
+
+//bits are written most significant first
+static void put_bits(string& bytes, uint64_t& pending, int& pending_count, uint64_t value, int count)
+{
+    if (count > 32)
+    {
+        put_bits(bytes, pending, pending_count, value >> 32, count - 32);
+        count = 32;
+    }
+    pending = pending << count | (value & ((uint64_t(1) << count) - 1));
+    pending_count += count;
+    while (pending_count >= 8)
+    {
+        pending_count -= 8;
+        bytes.push_back((char)(pending >> pending_count));
+    }
+    pending &= (uint64_t(1) << pending_count) - 1;
+}
+
+struct BitReader
+{
+    string_view bytes;
+    size_t pos = 0;
+    bool ok = true;
+
+    uint64_t get(int count)
+    {
+        uint64_t value = 0;
+        while (count > 0)
+        {
+            if ((pos >> 3) >= bytes.size())
+            {
+                ok = false;
+                return 0;
+            }
+            int byte = (uint8_t)bytes[pos >> 3];
+            int available = 8 - (int)(pos & 7);
+            int take = min(available, count);
+            value = value << take | (uint64_t)((byte >> (available - take)) & ((1 << take) - 1));
+            pos += take;
+            count -= take;
+        }
+        return value;
+    }
+};
+
+//delta-of-delta prefixes: 0, 10 + 7 bits, 110 + 12, 1110 + 20, 1111 + 64
+static const int DOD_BITS[4] = {7, 12, 20, 64};
+
+static void put_dod(string& bytes, uint64_t& pending, int& pending_count, int64_t dod)
+{
+    if (dod == 0)
+    {
+        put_bits(bytes, pending, pending_count, 0, 1);
+        return;
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        int bits = DOD_BITS[i];
+        int64_t limit = bits == 64 ? INT64_MAX : int64_t(1) << (bits - 1);
+        if (bits == 64 || (dod >= -limit && dod < limit))
+        {
+            //i + 1 ones, then a zero unless this is the last prefix
+            int prefix_bits = i < 3 ? i + 2 : 4;
+            uint64_t prefix = i < 3 ? ((uint64_t(1) << (i + 1)) - 1) << 1 : 0xf;
+            put_bits(bytes, pending, pending_count, prefix, prefix_bits);
+            put_bits(bytes, pending, pending_count, (uint64_t)dod, bits);
+            return;
+        }
+    }
+}
+
+static int64_t get_dod(BitReader& reader)
+{
+    int ones = 0;
+    while (ones < 4 && reader.get(1) == 1) {ones++;}
+    if (ones == 0) {return 0;}
+
+    int bits = DOD_BITS[ones - 1];
+    uint64_t raw = reader.get(bits);
+    if (bits == 64) {return (int64_t)raw;}
+    //sign extend
+    uint64_t sign = uint64_t(1) << (bits - 1);
+    return (int64_t)((raw ^ sign) - sign);
+}
+
+static void decode_samples(string_view bits, SimTime first, uint32_t count, SimTime from, SimTime to,
+                           vector<StatSample>& result, bool& ok)
+{
+    BitReader reader{bits};
+    StatSample sample;
+    sample.time = first;
+    int values[STAT_COUNT];
+    int64_t delta = 0;
+
+    for (uint32_t i = 0; i < count && reader.ok; i++)
+    {
+        if (i > 0)
+        {
+            delta += get_dod(reader);
+            sample.time += delta;
+        }
+        for (int s = 0; s < STAT_COUNT; s++)
+        {
+            if (i == 0 || reader.get(1) == 1) {values[s] = (int)reader.get(VALUE_BITS);}
+        }
+        if (sample.time >= to) {break;}
+        if (sample.time < from) {continue;}
+
+        sample.stats = Stats{values[HEALTH], values[HUNGER], values[HAPPINESS], values[STRESS]};
+        result.push_back(sample);
+    }
+    if (!reader.ok) {ok = false;}
+}
+
+//true while a block with this many buckets could still store its rollup
+static bool worth_storing(uint32_t buckets)
+{
+    return buckets * MIN_BUCKET_SAMPLES <= SeriesStore::BLOCK_SAMPLES;
+}
+
+static void start_bucket(StatRollup& rollup, SimTime start, const int* values)
+{
+    rollup.start = start;
+    rollup.count = 0;
+    for (int s = 0; s < STAT_COUNT; s++)
+    {
+        rollup.min[s] = (uint8_t)values[s];
+        rollup.max[s] = (uint8_t)values[s];
+        rollup.sum[s] = 0;
+    }
+}
+
+static void add_to_bucket(StatRollup& rollup, const int* values)
+{
+    rollup.count++;
+    for (int s = 0; s < STAT_COUNT; s++)
+    {
+        rollup.min[s] = min(rollup.min[s], (uint8_t)values[s]);
+        rollup.max[s] = max(rollup.max[s], (uint8_t)values[s]);
+        rollup.sum[s] += (uint32_t)values[s];
+    }
+}
+
+static void add_sample(vector<StatRollup>& rollups, SimTime width, SimTime time, const int* values)
+{
+    SimTime start = time - time % width;
+    if (rollups.empty() || rollups.back().start != start)
+    {
+        rollups.emplace_back();
+        start_bucket(rollups.back(), start, values);
+    }
+    add_to_bucket(rollups.back(), values);
+}
+
+//bucket starts are stored as a count of buckets since the previous one,
+//sums as an offset from count * min, so a typical entry is about 14 bytes
+static void encode_rollup(const StatRollup& rollup, SimTime width, SimTime& previous, string& out)
+{
+    put_varint(out, (rollup.start - previous) / width);
+    previous = rollup.start;
+    put_varint(out, rollup.count);
+    for (int s = 0; s < STAT_COUNT; s++)
+    {
+        put_u8(out, rollup.min[s]);
+        put_u8(out, rollup.max[s]);
+        put_varint(out, rollup.sum[s] - rollup.count * rollup.min[s]);
+    }
+}
+
+static bool decode_rollups(string_view in, SimTime width, vector<StatRollup>& rollups)
+{
+    uint64_t count;
+    if (!get_varint(in, count) || count > in.size()) {return false;}
+    rollups.resize(count);
+    SimTime previous = 0;
+    for (StatRollup& rollup : rollups)
+    {
+        uint64_t buckets;
+        uint64_t samples;
+        if (!get_varint(in, buckets) || !get_varint(in, samples)) {return false;}
+        rollup.start = previous + buckets * width;
+        previous = rollup.start;
+        rollup.count = (uint32_t)samples;
+        for (int s = 0; s < STAT_COUNT; s++)
+        {
+            uint64_t extra;
+            if (!get_u8(in, rollup.min[s]) || !get_u8(in, rollup.max[s]) || !get_varint(in, extra)) {return false;}
+            rollup.sum[s] = (uint32_t)(extra + rollup.count * rollup.min[s]);
+        }
+    }
+    return true;
+}
+
+//keeps only buckets overlapping [from, to), folding a bucket that was
+//split across two blocks back together
+static void merge_rollups(const vector<StatRollup>& rollups, SimTime width, SimTime from, SimTime to,
+                          vector<StatRollup>& result)
+{
+    for (const StatRollup& rollup : rollups)
+    {
+        if (rollup.start >= to || rollup.start + width <= from) {continue;}
+        if (result.empty() || result.back().start != rollup.start)
+        {
+            result.push_back(rollup);
+            continue;
+        }
+
+        StatRollup& into = result.back();
+        into.count += rollup.count;
+        for (int s = 0; s < STAT_COUNT; s++)
+        {
+            into.min[s] = min(into.min[s], rollup.min[s]);
+            into.max[s] = max(into.max[s], rollup.max[s]);
+            into.sum[s] += rollup.sum[s];
+        }
+    }
+}
+
+SeriesStore::SeriesStore()
+{
+    end = 0;
+    block_total = 0;
+}
+
+SeriesStore::~SeriesStore()
+{
+    if (out.is_open()) {flush();}
+}
+
+bool SeriesStore::open(const string& file)
+{
+    lock_guard<mutex> guard(lock);
+    if (out.is_open()) {out.close();}
+    if (in.is_open()) {in.close();}
+    path = file;
+    blocks.clear();
+    open_blocks.clear();
+    block_total = 0;
+
+    if (!filesystem::exists(path))
+    {
+        ofstream create(path, ios::binary);
+        string header(MAGIC, sizeof(MAGIC));
+        put_u32(header, VERSION);
+        create.write(header.data(), header.size());
+        if (!create)
+        {
+            cout << "Could not create series file " << path << endl;
+            return false;
+        }
+    }
+
+    in.open(path, ios::binary);
+    if (!in)
+    {
+        cout << "Could not open series file " << path << endl;
+        return false;
+    }
+    if (!scan()) {return false;}
+
+    out.open(path, ios::binary | ios::app);
+    if (!out)
+    {
+        cout << "Could not open series file " << path << " for writing" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool SeriesStore::scan()
+{
+    uint64_t size = filesystem::file_size(path);
+
+    string header(FILE_HEADER_SIZE, '\0');
+    in.read(header.data(), header.size());
+    string_view view(header);
+    string_view magic;
+    uint32_t version;
+    if (!in || !get_bytes(view, sizeof(MAGIC), magic) || magic != string_view(MAGIC, sizeof(MAGIC))
+        || !get_u32(view, version) || version != VERSION)
+    {
+        cout << "Series file " << path << " has a bad header" << endl;
+        return false;
+    }
+
+    //walk the block headers, skipping over the sections
+    end = FILE_HEADER_SIZE;
+    string bytes(BLOCK_HEADER_SIZE, '\0');
+    while (end + BLOCK_HEADER_SIZE <= size)
+    {
+        in.seekg(end);
+        in.read(bytes.data(), bytes.size());
+        if (!in) {break;}
+
+        uint32_t stored_crc = 0;
+        string_view trailer = string_view(bytes).substr(BLOCK_HEADER_SIZE - 4);
+        get_u32(trailer, stored_crc);
+        if (crc32c(bytes.data(), BLOCK_HEADER_SIZE - 4) != stored_crc) {break;}
+
+        PetId pet;
+        BlockRef ref;
+        view = bytes;
+        get_u64(view, pet);
+        get_u64(view, ref.first);
+        get_u64(view, ref.last);
+        get_u32(view, ref.count);
+        uint64_t length = 0;
+        for (int s = 0; s < SECTION_COUNT; s++)
+        {
+            get_u32(view, ref.length[s]);
+            get_u32(view, ref.crc[s]);
+            length += ref.length[s];
+        }
+
+        ref.offset = end + BLOCK_HEADER_SIZE;
+        if (ref.offset + length > size) {break;}
+
+        blocks[pet].push_back(ref);
+        block_total++;
+        end = ref.offset + length;
+    }
+    in.clear();
+
+    if (end < size)
+    {
+        cout << "Series file " << path << " had a torn block, dropping the last " << size - end << " bytes" << endl;
+        error_code error;
+        filesystem::resize_file(path, end, error);
+        if (error)
+        {
+            cout << "Could not truncate " << path << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SeriesStore::append(PetId pet, SimTime time, const Stats& stats)
+{
+    lock_guard<mutex> guard(lock);
+    if (!out.is_open()) {return false;}
+
+    int values[STAT_COUNT] = {stats.health, stats.hunger, stats.happiness, stats.stress};
+
+    auto found = open_blocks.find(pet);
+    if (found == open_blocks.end())
+    {
+        //carry on from the last sealed block so time stays monotonic
+        auto sealed = blocks.find(pet);
+        if (sealed != blocks.end() && time < sealed->second.back().last)
+        {
+            cout << "Series sample for pet " << pet << " goes back in time" << endl;
+            return false;
+        }
+        found = open_blocks.emplace(pet, OpenBlock()).first;
+        found->second.count = 0;
+    }
+    OpenBlock& block = found->second;
+
+    if (block.count == 0)
+    {
+        block.bits.clear();
+        block.pending_bits = 0;
+        block.pending_count = 0;
+        block.first = time;
+        block.last_delta = 0;
+        for (int s = 0; s < STAT_COUNT; s++)
+        {
+            put_bits(block.bits, block.pending_bits, block.pending_count, (uint64_t)values[s], VALUE_BITS);
+        }
+    }
+    else
+    {
+        if (time < block.last)
+        {
+            cout << "Series sample for pet " << pet << " goes back in time" << endl;
+            return false;
+        }
+        int64_t delta = (int64_t)(time - block.last);
+        put_dod(block.bits, block.pending_bits, block.pending_count, delta - block.last_delta);
+        block.last_delta = delta;
+
+        int previous[STAT_COUNT] = {block.last_stats.health, block.last_stats.hunger, block.last_stats.happiness,
+                                    block.last_stats.stress};
+        for (int s = 0; s < STAT_COUNT; s++)
+        {
+            if (values[s] == previous[s])
+            {
+                put_bits(block.bits, block.pending_bits, block.pending_count, 0, 1);
+                continue;
+            }
+            put_bits(block.bits, block.pending_bits, block.pending_count, 1, 1);
+            put_bits(block.bits, block.pending_bits, block.pending_count, (uint64_t)values[s], VALUE_BITS);
+        }
+    }
+    block.last = time;
+    block.last_stats = stats;
+    block.count++;
+    add_open_sample(block, time, values);
+
+    if (block.count >= BLOCK_SAMPLES)
+    {
+        bool sealed = seal(pet, block);
+        open_blocks.erase(found);
+        return sealed;
+    }
+    return true;
+}
+
+void SeriesStore::add_open_sample(OpenBlock& block, SimTime time, const int* values)
+{
+    for (int r = 0; r < RESOLUTION_COUNT; r++)
+    {
+        SimTime start = time - time % WIDTHS[r];
+        StatRollup& current = block.current[r];
+        if (block.count == 1)
+        {
+            block.closed[r].clear();
+            block.closed_count[r] = 0;
+            block.closed_start[r] = 0;
+            start_bucket(current, start, values);
+        }
+        else if (current.start != start)
+        {
+            //the bucket is done, keep it encoded only while the block could
+            //still end up storing this resolution
+            block.closed_count[r]++;
+            if (worth_storing(block.closed_count[r] + 1))
+            {
+                encode_rollup(current, WIDTHS[r], block.closed_start[r], block.closed[r]);
+            }
+            else if (!block.closed[r].empty()) {string().swap(block.closed[r]);}
+            start_bucket(current, start, values);
+        }
+        add_to_bucket(current, values);
+    }
+}
+
+//the open block's buckets at one resolution, rebuilt from its raw samples
+//if the closed ones were only counted
+bool SeriesStore::open_rollups(const OpenBlock& block, Resolution resolution, vector<StatRollup>& result)
+{
+    SimTime width = WIDTHS[resolution];
+    if (worth_storing(block.closed_count[resolution] + 1))
+    {
+        string data;
+        put_varint(data, block.closed_count[resolution]);
+        data.append(block.closed[resolution]);
+        if (!decode_rollups(data, width, result)) {return false;}
+        result.push_back(block.current[resolution]);
+        return true;
+    }
+
+    string data = block.bits;
+    if (block.pending_count > 0) {data.push_back((char)(block.pending_bits << (8 - block.pending_count)));}
+    vector<StatSample> raw;
+    bool ok = true;
+    decode_samples(data, block.first, block.count, 0, ~SimTime(0), raw, ok);
+    for (const StatSample& sample : raw)
+    {
+        int values[STAT_COUNT] = {sample.stats.health, sample.stats.hunger, sample.stats.happiness, sample.stats.stress};
+        add_sample(result, width, sample.time, values);
+    }
+    return ok;
+}
+
+void SeriesStore::sample(const PetRegistry& registry, SimTime now)
+{
+    registry.for_each([&](PetId id, const PetHandle& pet)
+    {
+        append(id, now, pet->get_stats());
+    });
+}
+
+bool SeriesStore::seal(PetId pet, OpenBlock& block)
+{
+    string sections[SECTION_COUNT];
+    sections[0] = block.bits;
+    if (block.pending_count > 0)
+    {
+        sections[0].push_back((char)(block.pending_bits << (8 - block.pending_count)));
+    }
+    //a rollup that barely summarises anything is left out, queries
+    //rebuild it from the raw section instead
+    for (int r = 0; r < RESOLUTION_COUNT; r++)
+    {
+        uint32_t buckets = block.closed_count[r] + 1;
+        if (buckets * MIN_BUCKET_SAMPLES <= block.count)
+        {
+            //the closed buckets are already encoded, only the open one is left
+            SimTime previous = block.closed_start[r];
+            put_varint(sections[1 + r], buckets);
+            sections[1 + r].append(block.closed[r]);
+            encode_rollup(block.current[r], WIDTHS[r], previous, sections[1 + r]);
+        }
+    }
+
+    BlockRef ref;
+    ref.first = block.first;
+    ref.last = block.last;
+    ref.count = block.count;
+    ref.offset = end + BLOCK_HEADER_SIZE;
+
+    string bytes;
+    put_u64(bytes, pet);
+    put_u64(bytes, ref.first);
+    put_u64(bytes, ref.last);
+    put_u32(bytes, ref.count);
+    for (int s = 0; s < SECTION_COUNT; s++)
+    {
+        ref.length[s] = (uint32_t)sections[s].size();
+        ref.crc[s] = crc32c(sections[s].data(), sections[s].size());
+        put_u32(bytes, ref.length[s]);
+        put_u32(bytes, ref.crc[s]);
+    }
+    put_u32(bytes, crc32c(bytes.data(), bytes.size()));
+    for (int s = 0; s < SECTION_COUNT; s++) {bytes.append(sections[s]);}
+
+    out.write(bytes.data(), bytes.size());
+    out.flush();
+    if (!out)
+    {
+        cout << "Could not write series block to " << path << endl;
+        return false;
+    }
+
+    end += bytes.size();
+    blocks[pet].push_back(ref);
+    block_total++;
+    block.count = 0;
+    return true;
+}
+
+bool SeriesStore::flush()
+{
+    lock_guard<mutex> guard(lock);
+    bool ok = true;
+    for (auto& entry : open_blocks)
+    {
+        if (entry.second.count > 0 && !seal(entry.first, entry.second)) {ok = false;}
+    }
+    open_blocks.clear();
+    return ok;
+}
+
+bool SeriesStore::read_section(const BlockRef& ref, int section, string& data) const
+{
+    uint64_t offset = ref.offset;
+    for (int s = 0; s < section; s++) {offset += ref.length[s];}
+
+    data.resize(ref.length[section]);
+    in.clear();
+    in.seekg(offset);
+    in.read(data.data(), data.size());
+    if (!in || crc32c(data.data(), data.size()) != ref.crc[section])
+    {
+        cout << "Series block at " << offset << " in " << path << " failed its checksum" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool SeriesStore::samples(PetId pet, SimTime from, SimTime to, vector<StatSample>& result) const
+{
+    lock_guard<mutex> guard(lock);
+    bool ok = true;
+
+    auto sealed = blocks.find(pet);
+    if (sealed != blocks.end())
+    {
+        //blocks are in time order, skip straight to the first that can overlap
+        const vector<BlockRef>& refs = sealed->second;
+        auto it = partition_point(refs.begin(), refs.end(), [&](const BlockRef& ref) {return ref.last < from;});
+        string data;
+        for (; it != refs.end() && it->first < to; ++it)
+        {
+            if (!read_section(*it, 0, data))
+            {
+                ok = false;
+                continue;
+            }
+            decode_samples(data, it->first, it->count, from, to, result, ok);
+        }
+    }
+
+    auto open = open_blocks.find(pet);
+    if (open != open_blocks.end() && open->second.count > 0 && open->second.last >= from && open->second.first < to)
+    {
+        const OpenBlock& block = open->second;
+        string data = block.bits;
+        if (block.pending_count > 0) {data.push_back((char)(block.pending_bits << (8 - block.pending_count)));}
+        decode_samples(data, block.first, block.count, from, to, result, ok);
+    }
+    return ok;
+}
+
+bool SeriesStore::rollups(PetId pet, Resolution resolution, SimTime from, SimTime to,
+                          vector<StatRollup>& result) const
+{
+    lock_guard<mutex> guard(lock);
+    SimTime width = WIDTHS[resolution];
+    bool ok = true;
+
+    auto sealed = blocks.find(pet);
+    if (sealed != blocks.end())
+    {
+        const vector<BlockRef>& refs = sealed->second;
+        auto it = partition_point(refs.begin(), refs.end(), [&](const BlockRef& ref)
+        {
+            return ref.last - ref.last % width + width <= from;
+        });
+        string data;
+        vector<StatRollup> decoded;
+        vector<StatSample> raw;
+        for (; it != refs.end() && it->first - it->first % width < to; ++it)
+        {
+            if (it->length[1 + resolution] == 0)
+            {
+                //not stored for this block, bucket the raw samples
+                if (!read_section(*it, 0, data))
+                {
+                    ok = false;
+                    continue;
+                }
+                raw.clear();
+                decoded.clear();
+                decode_samples(data, it->first, it->count, 0, ~SimTime(0), raw, ok);
+                for (const StatSample& sample : raw)
+                {
+                    int values[STAT_COUNT] = {sample.stats.health, sample.stats.hunger, sample.stats.happiness,
+                                              sample.stats.stress};
+                    add_sample(decoded, width, sample.time, values);
+                }
+            }
+            else if (!read_section(*it, 1 + resolution, data) || !decode_rollups(data, width, decoded))
+            {
+                ok = false;
+                continue;
+            }
+            merge_rollups(decoded, width, from, to, result);
+        }
+    }
+
+    auto open = open_blocks.find(pet);
+    if (open != open_blocks.end() && open->second.count > 0)
+    {
+        vector<StatRollup> decoded;
+        if (!open_rollups(open->second, resolution, decoded)) {ok = false;}
+        merge_rollups(decoded, width, from, to, result);
+    }
+    return ok;
+}
+
+size_t SeriesStore::block_count() const
+{
+    lock_guard<mutex> guard(lock);
+    return block_total;
+}
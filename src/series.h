@@ -0,0 +1,127 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "clock.h"
+#include "pasochan.h"
+#include "registry.h"
+
+struct StatSample
+{
+    SimTime time;
+    Stats stats;
+};
+
+enum Resolution : uint8_t
+{
+    MINUTE,
+    HOUR,
+    DAY,
+    RESOLUTION_COUNT
+};
+
+//one bucket of samples at a rollup resolution
+struct StatRollup
+{
+    SimTime start;
+    uint32_t count;
+    uint8_t min[STAT_COUNT];
+    uint8_t max[STAT_COUNT];
+    uint32_t sum[STAT_COUNT];
+
+    double mean(StatId stat) const;
+};
+
+//append-only on-disk time series of every pet's stats, for long-term
+//graphs. Samples are grouped per pet into blocks of up to BLOCK_SAMPLES;
+//inside a block timestamps are delta-of-delta coded and each stat costs
+//one bit when unchanged and eight when it moved. Every block also carries
+//its minute, hour and day rollups as separate sections (unless samples
+//are too sparse for a rollup to be worth storing), so a query reads and
+//decodes only the blocks (and sections) that overlap its range.
+//Only block headers are read when the file is opened.
+class SeriesStore
+{
+public:
+    static const uint32_t BLOCK_SAMPLES = 1024;
+
+    //bucket width of each resolution, in ms
+    static SimTime bucket_width(Resolution resolution);
+
+private:
+    //raw samples, then one section per resolution
+    static const int SECTION_COUNT = 1 + RESOLUTION_COUNT;
+
+    struct BlockRef
+    {
+        SimTime first;
+        SimTime last;
+        uint32_t count;
+        uint64_t offset;                    //start of the first section
+        uint32_t length[SECTION_COUNT];
+        uint32_t crc[SECTION_COUNT];
+    };
+
+    //the block still being filled for one pet, kept in memory
+    struct OpenBlock
+    {
+        string bits;
+        uint64_t pending_bits;
+        int pending_count;
+        SimTime first;
+        SimTime last;
+        int64_t last_delta;
+        Stats last_stats;
+        uint32_t count;
+
+        //per resolution: the bucket still filling, and the buckets already
+        //closed, encoded as they will be written. Once a block has too many
+        //buckets for its rollup to be stored at all, closed ones are only counted.
+        StatRollup current[RESOLUTION_COUNT];
+        string closed[RESOLUTION_COUNT];
+        uint32_t closed_count[RESOLUTION_COUNT];
+        SimTime closed_start[RESOLUTION_COUNT];
+    };
+
+    mutable mutex lock;
+    string path;
+    ofstream out;
+    mutable ifstream in;
+    uint64_t end;
+    unordered_map<PetId, vector<BlockRef>> blocks;
+    unordered_map<PetId, OpenBlock> open_blocks;
+    size_t block_total;
+
+    bool scan();
+    static void add_open_sample(OpenBlock& block, SimTime time, const int* values);
+    static bool open_rollups(const OpenBlock& block, Resolution resolution, vector<StatRollup>& result);
+    bool seal(PetId pet, OpenBlock& block);
+    bool read_section(const BlockRef& ref, int section, string& data) const;
+
+public:
+    SeriesStore();
+    ~SeriesStore();
+
+    //creates the file if it does not exist. A torn block at the end (from a
+    //crash mid-write) is cut off.
+    bool open(const string& file);
+
+    //times must not go backwards for a pet
+    bool append(PetId pet, SimTime time, const Stats& stats);
+    //one sample of every registered pet
+    void sample(const PetRegistry& registry, SimTime now);
+
+    //writes out every partly filled block. Each flush ends those blocks
+    //early, so call it on shutdown or every few minutes, not every tick.
+    bool flush();
+
+    //samples with from <= time < to, oldest first
+    bool samples(PetId pet, SimTime from, SimTime to, vector<StatSample>& result) const;
+    //buckets overlapping [from, to), oldest first
+    bool rollups(PetId pet, Resolution resolution, SimTime from, SimTime to, vector<StatRollup>& result) const;
+
+    size_t block_count() const;
+};
@@ -0,0 +1,477 @@
+#include "snapshot.h"
+#include <atomic>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include "checksum.h"
+#include "codec.h"
+#include "compress.h"
+
+static const char MAGIC[8] = {'P', 'A', 'S', 'O', 'S', 'N', 'A', 'P'};
+static const uint32_t VERSION = 6;
+//pets per shard, shards are the unit of parallel loading
+static const size_t SHARD_PETS = 16384;
+//magic, version, schema, pet count, shard count
+static const size_t HEADER_SIZE = sizeof(MAGIC) + 4 + 4 + 8 + 4;
+//offset, length, crc, pets
+static const size_t SHARD_ENTRY_SIZE = 8 + 8 + 4 + 4;
+//shard table offset, crc of header and table
+static const size_t FOOTER_SIZE = 8 + 4;
+
+struct ShardRef
+{
+    uint64_t offset;
+    uint64_t length;
+    uint32_t crc;
+    uint32_t pets;
+};
+
+PetRecord capture_pet(PetId id, const PasoChan& pet, const TimerWheel* timers)
+{
+    PetRecord record;
+    record.id = id;
+    record.stats = pet.get_packed();
+    record.saved_at = sim_now();
+    for (const pmr::string& owner : pet.get_owners())
+    {
+        record.owners.emplace_back(owner);
+    }
+
+    if (timers != nullptr)
+    {
+        vector<TimerEvent> pending;
+        timers->pending(id, pending);
+        for (const TimerEvent& event : pending)
+        {
+            record.timers.push_back(PendingTimer{event.kind, event.due});
+        }
+    }
+    return record;
+}
+
+PetHandle restore_pet(const PetRecord& record, pmr::memory_resource* resource, pmr::memory_resource* owners_resource)
+{
+    if (record.owners.empty()) {return PetHandle();}
+
+    //built straight from the record, loads go through here in parallel and
+    //must not serialise on rcu_retire(). The restored list still comes from
+    //resource, only later ones move.
+    PetHandle pet = make_pet(record.owners, record.stats, resource);
+    if (owners_resource != nullptr) {pet->set_owner_resource(owners_resource);}
+    return pet;
+}
+
+void restore_timers(const PetRecord& record, TimerWheel& timers)
+{
+    for (const PendingTimer& timer : record.timers)
+    {
+        timers.schedule(record.id, timer.kind, timer.due);
+    }
+}
+
+void encode_record(const PetRecord& record, string& out)
+{
+    put_u64(out, record.id);
+    PetSchema::serialize(record.stats, out);
+    put_u64(out, record.saved_at);
+
+    //counts and lengths are varints, so no size of list or name is out of range
+    put_varint(out, record.owners.size());
+    for (const string& owner : record.owners)
+    {
+        put_varint(out, owner.size());
+        out.append(owner);
+    }
+
+    put_varint(out, record.timers.size());
+    for (const PendingTimer& timer : record.timers)
+    {
+        put_u16(out, timer.kind);
+        put_u64(out, timer.due);
+    }
+}
+
+bool decode_record(string_view& in, PetRecord& record)
+{
+    uint64_t owner_count;
+    if (!get_u64(in, record.id) || !PetSchema::deserialize(in, record.stats) || !get_u64(in, record.saved_at)) {return false;}
+
+    //every entry takes at least a byte, a larger count is damage
+    if (!get_varint(in, owner_count) || owner_count > in.size()) {return false;}
+    record.owners.clear();
+    for (uint64_t i = 0; i < owner_count; i++)
+    {
+        uint64_t size;
+        string_view name;
+        if (!get_varint(in, size) || !get_bytes(in, size, name)) {return false;}
+        record.owners.emplace_back(name);
+    }
+
+    uint64_t timer_count;
+    if (!get_varint(in, timer_count) || timer_count > in.size()) {return false;}
+    record.timers.clear();
+    for (uint64_t i = 0; i < timer_count; i++)
+    {
+        PendingTimer timer;
+        if (!get_u16(in, timer.kind) || !get_u64(in, timer.due)) {return false;}
+        record.timers.push_back(timer);
+    }
+    return true;
+}
+
+//a shard starts with a table of the owner names used in it, the pets then
+//refer to their owners by index into the table
+static void encode_shard(const vector<PetRecord>& records, string& out)
+{
+    unordered_map<string_view, uint32_t> table;
+    vector<string_view> names;
+    for (const PetRecord& record : records)
+    {
+        for (const string& owner : record.owners)
+        {
+            if (table.emplace(owner, (uint32_t)names.size()).second) {names.push_back(owner);}
+        }
+    }
+
+    put_u32(out, (uint32_t)names.size());
+    for (string_view name : names)
+    {
+        put_varint(out, name.size());
+        out.append(name);
+    }
+
+    for (const PetRecord& record : records)
+    {
+        put_u64(out, record.id);
+        PetSchema::serialize(record.stats, out);
+        put_u64(out, record.saved_at);
+        put_varint(out, record.owners.size());
+        for (const string& owner : record.owners) {put_u32(out, table[owner]);}
+
+        put_varint(out, record.timers.size());
+        for (const PendingTimer& timer : record.timers)
+        {
+            put_u16(out, timer.kind);
+            put_u64(out, timer.due);
+        }
+    }
+}
+
+//restores every pet in one compressed shard into the registry, adding the
+//ids it inserted to inserted
+static bool load_shard(string_view packed, uint32_t pets, PetRegistry& registry, TimerWheel* timers,
+                       const PetHooks* hooks, pmr::memory_resource* resource, pmr::memory_resource* owners_resource,
+                       vector<PetId>& inserted)
+{
+    string contents;
+    if (!decompress(packed, contents)) {return false;}
+    string_view shard(contents);
+
+    uint32_t name_count;
+    if (!get_u32(shard, name_count) || name_count > shard.size()) {return false;}
+    vector<string_view> names(name_count);
+    for (string_view& name : names)
+    {
+        uint64_t size;
+        if (!get_varint(shard, size) || !get_bytes(shard, size, name)) {return false;}
+    }
+
+    //one record reused for the whole shard, so its strings keep their capacity
+    PetRecord record;
+    for (uint32_t i = 0; i < pets; i++)
+    {
+        uint64_t owner_count;
+        uint64_t timer_count;
+        if (!get_u64(shard, record.id) || !PetSchema::deserialize(shard, record.stats) || !get_u64(shard, record.saved_at)
+            || !get_varint(shard, owner_count) || owner_count > shard.size())
+        {
+            return false;
+        }
+
+        record.owners.resize(owner_count);
+        for (string& owner : record.owners)
+        {
+            uint32_t index;
+            if (!get_u32(shard, index) || index >= names.size()) {return false;}
+            owner.assign(names[index]);
+        }
+
+        if (!get_varint(shard, timer_count) || timer_count > shard.size()) {return false;}
+        record.timers.resize(timer_count);
+        for (PendingTimer& timer : record.timers)
+        {
+            if (!get_u16(shard, timer.kind) || !get_u64(shard, timer.due)) {return false;}
+        }
+
+        PetHandle pet = restore_pet(record, resource, owners_resource);
+        if (!pet || !registry.insert(record.id, pet)) {continue;}
+        inserted.push_back(record.id);
+        pet->attach(record.id, hooks);
+        if (timers != nullptr) {restore_timers(record, *timers);}
+    }
+    return true;
+}
+
+//takes back what a load that failed part way had inserted. Dropping the
+//pets detaches them from the hooks; alerts they raised stay raised.
+static void unload(const vector<PetId>& inserted, PetRegistry& registry, TimerWheel* timers)
+{
+    for (PetId id : inserted)
+    {
+        registry.erase(id);
+        if (timers != nullptr) {timers->cancel_all(id);}
+    }
+}
+
+bool save_snapshot(const string& path, const PetRegistry& registry, const TimerWheel* timers)
+{
+    string tmp = path + ".tmp";
+    ofstream out(tmp, ios::binary | ios::trunc);
+    if (!out)
+    {
+        cout << "Could not open " << tmp << " for writing" << endl;
+        return false;
+    }
+
+    vector<pair<PetId, PetHandle>> pets = registry.snapshot();
+    size_t shard_count = (pets.size() + SHARD_PETS - 1) / SHARD_PETS;
+
+    string header(MAGIC, sizeof(MAGIC));
+    put_u32(header, VERSION);
+    put_u32(header, PetSchema::fingerprint());
+    put_u64(header, pets.size());
+    put_u32(header, (uint32_t)shard_count);
+    out.write(header.data(), header.size());
+
+    //each shard is encoded, compressed and written on its own, then listed
+    //in the table
+    string table;
+    uint64_t offset = header.size();
+    vector<PetRecord> records;
+    string encoded;
+    string shard;
+    for (size_t s = 0; s < shard_count; s++)
+    {
+        size_t begin = s * SHARD_PETS;
+        size_t end = min(begin + SHARD_PETS, pets.size());
+        records.clear();
+        for (size_t i = begin; i < end; i++)
+        {
+            records.push_back(capture_pet(pets[i].first, *pets[i].second, timers));
+        }
+
+        encoded.clear();
+        encode_shard(records, encoded);
+        shard.clear();
+        compress(encoded, shard);
+        out.write(shard.data(), shard.size());
+
+        put_u64(table, offset);
+        put_u64(table, shard.size());
+        put_u32(table, crc32c(shard.data(), shard.size()));
+        put_u32(table, (uint32_t)(end - begin));
+        offset += shard.size();
+    }
+
+    string footer;
+    put_u64(footer, offset);
+    put_u32(footer, crc32c(table.data(), table.size(), crc32c(header.data(), header.size())));
+    out.write(table.data(), table.size());
+    out.write(footer.data(), footer.size());
+    out.close();
+
+    if (!out || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        cout << "Could not write snapshot " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+//read-only mapping of a whole snapshot file
+class MappedFile
+{
+private:
+    int fd = -1;
+    void* data = MAP_FAILED;
+    size_t size = 0;
+
+public:
+    ~MappedFile()
+    {
+        if (data != MAP_FAILED) {munmap(data, size);}
+        if (fd >= 0) {close(fd);}
+    }
+
+    bool open(const string& path, bool readahead)
+    {
+        fd = ::open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {return false;}
+        size = info.st_size;
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {return false;}
+
+        //start reading the whole file in now rather than a fault at a time
+        if (readahead) {madvise(data, size, MADV_WILLNEED);}
+        return true;
+    }
+
+    string_view view() const
+    {
+        return string_view((const char*)data, size);
+    }
+};
+
+//checks the header and the shard table, leaving the shards themselves
+static bool read_layout(const string& path, string_view file, vector<ShardRef>& shards, uint64_t& count)
+{
+    string_view view = file;
+    string_view magic;
+    uint32_t version;
+    uint32_t schema;
+    uint32_t shard_count;
+    if (file.size() < HEADER_SIZE + FOOTER_SIZE
+        || !get_bytes(view, sizeof(MAGIC), magic) || magic != string_view(MAGIC, sizeof(MAGIC))
+        || !get_u32(view, version) || version != VERSION
+        || !get_u32(view, schema) || schema != PetSchema::fingerprint()
+        || !get_u64(view, count) || !get_u32(view, shard_count))
+    {
+        cout << "Snapshot " << path << " has a bad header" << endl;
+        return false;
+    }
+
+    string_view footer = file.substr(file.size() - FOOTER_SIZE);
+    uint64_t table_offset;
+    uint32_t stored_crc;
+    get_u64(footer, table_offset);
+    get_u32(footer, stored_crc);
+    //checked on its own first so a damaged offset cannot wrap the sum below
+    if (table_offset > file.size() - FOOTER_SIZE
+        || table_offset + (uint64_t)shard_count * SHARD_ENTRY_SIZE + FOOTER_SIZE != file.size())
+    {
+        cout << "Snapshot " << path << " has a bad shard table" << endl;
+        return false;
+    }
+
+    string_view table = file.substr(table_offset, (size_t)shard_count * SHARD_ENTRY_SIZE);
+    if (crc32c(table.data(), table.size(), crc32c(file.data(), HEADER_SIZE)) != stored_crc)
+    {
+        cout << "Snapshot " << path << " failed its checksum" << endl;
+        return false;
+    }
+
+    shards.resize(shard_count);
+    for (ShardRef& shard : shards)
+    {
+        get_u64(table, shard.offset);
+        get_u64(table, shard.length);
+        get_u32(table, shard.crc);
+        get_u32(table, shard.pets);
+        if (shard.offset < HEADER_SIZE || shard.offset > table_offset || shard.length > table_offset - shard.offset)
+        {
+            cout << "Snapshot " << path << " has a bad shard table" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool check_shard(string_view file, const ShardRef& shard)
+{
+    return crc32c(file.data() + shard.offset, shard.length) == shard.crc;
+}
+
+bool load_snapshot(const string& path, PetRegistry& registry, TimerWheel* timers, const PetHooks* hooks,
+                   pmr::memory_resource* resource, pmr::memory_resource* owners_resource)
+{
+    MappedFile mapped;
+    if (!mapped.open(path, true))
+    {
+        cout << "Could not open snapshot " << path << endl;
+        return false;
+    }
+    string_view file = mapped.view();
+
+    vector<ShardRef> shards;
+    uint64_t count;
+    if (!read_layout(path, file, shards, count)) {return false;}
+
+    //check every shard before touching the registry
+    for (const ShardRef& shard : shards)
+    {
+        if (!check_shard(file, shard))
+        {
+            cout << "Snapshot " << path << " failed its checksum" << endl;
+            return false;
+        }
+    }
+
+    registry.reserve(registry.size() + count);
+    vector<PetId> inserted;
+    for (const ShardRef& shard : shards)
+    {
+        if (!load_shard(file.substr(shard.offset, shard.length), shard.pets, registry, timers, hooks, resource,
+                        owners_resource, inserted))
+        {
+            cout << "Snapshot " << path << " has a bad record" << endl;
+            unload(inserted, registry, timers);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool load_snapshot(const string& path, PetRegistry& registry, TimerWheel* timers, const PetHooks* hooks,
+                   WorkerPool& workers, PetMemory& memory)
+{
+    MappedFile mapped;
+    if (!mapped.open(path, true))
+    {
+        cout << "Could not open snapshot " << path << endl;
+        return false;
+    }
+    string_view file = mapped.view();
+
+    vector<ShardRef> shards;
+    uint64_t count;
+    if (!read_layout(path, file, shards, count)) {return false;}
+
+    atomic<bool> ok{true};
+    workers.parallel_for(shards.size(), [&](size_t s)
+    {
+        if (!check_shard(file, shards[s])) {ok = false;}
+    });
+    if (!ok)
+    {
+        cout << "Snapshot " << path << " failed its checksum" << endl;
+        return false;
+    }
+
+    //the registry's shards take concurrent inserts, each snapshot shard
+    //allocates from its own arena
+    registry.reserve(registry.size() + count);
+    vector<pmr::memory_resource*> arenas = memory.bulk_shards(shards.size());
+    vector<vector<PetId>> inserted(shards.size());
+    workers.parallel_for(shards.size(), [&](size_t s)
+    {
+        //each arena is only used by its own shard while loading, owner
+        //changes made later go to the thread safe churn pool instead
+        string_view shard = file.substr(shards[s].offset, shards[s].length);
+        if (!load_shard(shard, shards[s].pets, registry, timers, hooks, arenas[s], memory.churn(), inserted[s]))
+        {
+            ok = false;
+        }
+    });
+    if (!ok)
+    {
+        cout << "Snapshot " << path << " has a bad record" << endl;
+        for (const vector<PetId>& ids : inserted) {unload(ids, registry, timers);}
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "memory.h"
+#include "owners.h"
+#include "pasochan.h"
+#include "registry.h"
+#include "timers.h"
+#include "workers.h"
+
+struct PendingTimer
+{
+    uint16_t kind;
+    SimTime due;
+};
+
+//everything persisted about one pet
+struct PetRecord
+{
+    PetId id;
+    StatWord stats;         //packed per PetSchema, fractions of a point included
+    SimTime saved_at;       //sim time the record was captured
+    vector<string> owners;
+    vector<PendingTimer> timers;
+};
+
+//timers may be nullptr when there is no wheel to save from or load into
+PetRecord capture_pet(PetId id, const PasoChan& pet, const TimerWheel* timers);
+//owner lists made after the restore come from owners_resource if it is
+//given (see PasoChan::set_owner_resource), otherwise from resource
+PetHandle restore_pet(const PetRecord& record, pmr::memory_resource* resource = pmr::get_default_resource(),
+                      pmr::memory_resource* owners_resource = nullptr);
+void restore_timers(const PetRecord& record, TimerWheel& timers);
+
+void encode_record(const PetRecord& record, string& out);
+bool decode_record(string_view& in, PetRecord& record);
+
+//whole-registry snapshot, split into independently compressed and
+//checksummed shards of pets that each carry their own owner name table:
+//header, shards, shard table, footer. Written to path + ".tmp" and renamed into place.
+bool save_snapshot(const string& path, const PetRegistry& registry, const TimerWheel* timers);
+
+//pets are created from resource (e.g. PetMemory::bulk()), attached to
+//hooks if given and their pending timers rescheduled if timers is given.
+//When resource is an arena, pass PetMemory::churn() as owners_resource
+//for the owner changes made once loading is over.
+//Every shard is verified before the registry is touched, and a record
+//that still fails to decode takes the pets already inserted back out.
+bool load_snapshot(const string& path, PetRegistry& registry, TimerWheel* timers, const PetHooks* hooks,
+                   pmr::memory_resource* resource = pmr::get_default_resource(),
+                   pmr::memory_resource* owners_resource = nullptr);
+
+//the same, verifying and loading the shards in parallel across workers
+//and inserting into the registry concurrently, each shard allocating from
+//its own arena of memory.bulk_shards(). Owner lists made after the load
+//come from memory.churn().
+bool load_snapshot(const string& path, PetRegistry& registry, TimerWheel* timers, const PetHooks* hooks,
+                   WorkerPool& workers, PetMemory& memory);
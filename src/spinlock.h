@@ -0,0 +1,26 @@
+#pragma once
+#include <atomic>
+using namespace std;
+
+//holds a spin lock on an atomic_flag for a short critical section,
+//sleeping on the flag instead of burning a core if it is contended
+class SpinGuard
+{
+private:
+    atomic_flag& flag;
+
+public:
+    explicit SpinGuard(atomic_flag& f) : flag(f)
+    {
+        while (flag.test_and_set(memory_order_acquire)) {flag.wait(true, memory_order_relaxed);}
+    }
+
+    ~SpinGuard()
+    {
+        flag.clear(memory_order_release);
+        flag.notify_one();
+    }
+
+    SpinGuard(const SpinGuard&) = delete;
+    SpinGuard& operator=(const SpinGuard&) = delete;
+};
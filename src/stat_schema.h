@@ -0,0 +1,191 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <type_traits>
+#include "codec.h"
+
+//stats are fixed point with this many fraction bits, 8.8 for the usual
+//0..100, so changes of less than a point (slow decay) add up exactly
+//with integer arithmetic only. Four stats that way take a 64-bit word,
+//which targets without lock-free 64-bit atomics (e.g. the 32-bit ESP32)
+//keep under a sequence lock instead (see statcell.h), so every target
+//gets the same precision.
+static constexpr int STAT_FRAC_BITS = 8;
+//one whole point in fixed point
+static constexpr int STAT_ONE = 1 << STAT_FRAC_BITS;
+static_assert(-STAT_ONE / 7 != 0, "slow decay steps such as a seventh of a point must not round to nothing");
+
+//whole points, rounding halves up
+constexpr int round_fixed(int64_t fixed)
+{
+    return (int)((fixed + STAT_ONE / 2) >> STAT_FRAC_BITS);
+}
+
+//one stat's bounds and starting value in whole points, fixed at compile
+//time. Values are stored as (value - Min) in fixed point, in just enough
+//bits for the range.
+template <int Min, int Max, int Init>
+struct Stat
+{
+    static_assert(Min <= Init && Init <= Max, "starting value must be within the bounds");
+
+    static constexpr int min = Min;
+    static constexpr int max = Max;
+    static constexpr int init = Init;
+    static constexpr int bits = bit_width((unsigned)(Max - Min) << STAT_FRAC_BITS);
+};
+
+//type-level list of stats. Generates the packed storage word (the
+//narrowest unsigned type that fits every field), pack/unpack, a
+//single-pass add-and-clamp and byte serialization, all unrolled at
+//compile time so a variant pays nothing for being configurable. The
+//plain forms take and give whole points (rounded on the way out), the
+//_fixed forms work in 1/STAT_ONE steps.
+template <typename... S>
+struct StatSchema
+{
+    static constexpr size_t count = sizeof...(S);
+    static constexpr array<int, count> mins = {S::min...};
+    static constexpr array<int, count> maxs = {S::max...};
+    static constexpr array<int, count> inits = {S::init...};
+    static constexpr array<int, count> widths = {S::bits...};
+
+    static constexpr array<int, count> compute_offsets()
+    {
+        array<int, count> out{};
+        int offset = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            out[i] = offset;
+            offset += widths[i];
+        }
+        return out;
+    }
+
+    static constexpr array<int, count> offsets = compute_offsets();
+    static constexpr int total_bits = (S::bits + ...);
+    static_assert(total_bits <= 64, "stats do not fit in one 64-bit word");
+
+    typedef conditional_t<total_bits <= 8, uint8_t,
+            conditional_t<total_bits <= 16, uint16_t,
+            conditional_t<total_bits <= 32, uint32_t, uint64_t>>> word_type;
+
+    //bytes used when serialized
+    static constexpr size_t bytes = (total_bits + 7) / 8;
+
+    static constexpr word_type mask(size_t i)
+    {
+        return (word_type)(((uint64_t)1 << widths[i]) - 1);
+    }
+
+    static constexpr int64_t clamp_fixed(size_t i, int64_t value)
+    {
+        //written as min/max so it compiles to conditional moves
+        int64_t low = (int64_t)mins[i] * STAT_ONE;
+        int64_t high = (int64_t)maxs[i] * STAT_ONE;
+        return value < low ? low : (value > high ? high : value);
+    }
+
+    static constexpr int get_fixed(word_type word, size_t i)
+    {
+        return (int)((word >> offsets[i]) & mask(i)) + mins[i] * STAT_ONE;
+    }
+
+    static constexpr int get(word_type word, size_t i)
+    {
+        return round_fixed(get_fixed(word, i));
+    }
+
+    static constexpr word_type pack_fixed(const int64_t (&values)[count])
+    {
+        word_type word = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            int64_t field = clamp_fixed(i, values[i]) - (int64_t)mins[i] * STAT_ONE;
+            word |= (word_type)((word_type)field << offsets[i]);
+        }
+        return word;
+    }
+
+    static constexpr word_type pack(const int (&values)[count])
+    {
+        int64_t fixed[count];
+        for (size_t i = 0; i < count; i++) {fixed[i] = (int64_t)values[i] * STAT_ONE;}
+        return pack_fixed(fixed);
+    }
+
+    static constexpr void unpack(word_type word, int (&values)[count])
+    {
+        for (size_t i = 0; i < count; i++) {values[i] = get(word, i);}
+    }
+
+    static constexpr word_type initial()
+    {
+        int values[count] = {S::init...};
+        return pack(values);
+    }
+
+    //adds every delta and clamps each field once
+    static constexpr word_type add_fixed(word_type word, const int64_t (&deltas)[count])
+    {
+        int64_t values[count];
+        for (size_t i = 0; i < count; i++) {values[i] = get_fixed(word, i) + deltas[i];}
+        return pack_fixed(values);
+    }
+
+    static constexpr word_type add(word_type word, const int (&deltas)[count])
+    {
+        int64_t fixed[count];
+        for (size_t i = 0; i < count; i++) {fixed[i] = (int64_t)deltas[i] * STAT_ONE;}
+        return add_fixed(word, fixed);
+    }
+
+    static void serialize(word_type word, string& out)
+    {
+        for (size_t i = 0; i < bytes; i++) {put_u8(out, (uint8_t)((uint64_t)word >> (8 * i)));}
+    }
+
+    static bool deserialize(string_view& in, word_type& word)
+    {
+        uint64_t raw = 0;
+        for (size_t i = 0; i < bytes; i++)
+        {
+            uint8_t b;
+            if (!get_u8(in, b)) {return false;}
+            raw |= (uint64_t)b << (8 * i);
+        }
+        word = (word_type)raw;
+        return true;
+    }
+
+    //identifies the layout so data written by another variant is rejected
+    static constexpr uint32_t fingerprint()
+    {
+        uint32_t hash = (2166136261u ^ (uint32_t)STAT_FRAC_BITS) * 16777619u;
+        for (size_t i = 0; i < count; i++)
+        {
+            for (int v : {mins[i], maxs[i], inits[i]})
+            {
+                hash = (hash ^ (uint32_t)v) * 16777619u;
+            }
+        }
+        return hash;
+    }
+};
+
+//product variants, picked at build time with -DPASOCHAN_KID_MODE or
+//-DPASOCHAN_HARDCORE_MODE. Fields are health, hunger, happiness, stress.
+typedef StatSchema<Stat<0, 100, 100>, Stat<0, 100, 100>, Stat<0, 100, 50>, Stat<0, 100, 40>> StandardSchema;
+//health never drops below 30 and stress tops out at 60
+typedef StatSchema<Stat<30, 100, 100>, Stat<0, 100, 100>, Stat<0, 100, 70>, Stat<0, 60, 20>> KidSchema;
+//starts hungry, unhappy and stressed
+typedef StatSchema<Stat<0, 100, 80>, Stat<0, 100, 60>, Stat<0, 100, 30>, Stat<0, 100, 60>> HardcoreSchema;
+
+#if defined(PASOCHAN_KID_MODE)
+typedef KidSchema PetSchema;
+#elif defined(PASOCHAN_HARDCORE_MODE)
+typedef HardcoreSchema PetSchema;
+#else
+typedef StandardSchema PetSchema;
+#endif
@@ -0,0 +1,125 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+using namespace std;
+
+//a pet's packed stats word with the few operations PasoChan needs. Where
+//an atomic of the word is lock free it is just that atomic.
+template <typename Word, bool = atomic<Word>::is_always_lock_free>
+class StatCell
+{
+private:
+    atomic<Word> word;
+
+public:
+    explicit StatCell(Word initial = 0) : word(initial)
+    {
+    }
+
+    Word load() const
+    {
+        return word.load(memory_order_acquire);
+    }
+
+    void store(Word value)
+    {
+        word.store(value, memory_order_release);
+    }
+
+    //as atomic::compare_exchange_weak, expected gets the current word on failure
+    bool compare_exchange(Word& expected, Word desired)
+    {
+        return word.compare_exchange_weak(expected, desired, memory_order_acq_rel, memory_order_relaxed);
+    }
+};
+
+//where a 64-bit atomic would go through libatomic's lock (e.g. the 32-bit
+//ESP32), the word is kept as two 32-bit halves under a sequence lock.
+//Readers never block writers and retry if a write overlapped them;
+//writers take turns on the sequence number, which is odd while a write is
+//in progress.
+template <typename Word>
+class StatCell<Word, false>
+{
+private:
+    static_assert(sizeof(Word) == 2 * sizeof(uint32_t), "the word is kept as two 32-bit halves");
+
+    atomic<uint32_t> sequence;
+    atomic<uint32_t> low;
+    atomic<uint32_t> high;
+
+    //makes the sequence odd, returns it
+    uint32_t lock()
+    {
+        uint32_t seq = sequence.load(memory_order_relaxed);
+        while (true)
+        {
+            if ((seq & 1) != 0)
+            {
+                sequence.wait(seq, memory_order_relaxed);
+                seq = sequence.load(memory_order_relaxed);
+                continue;
+            }
+            if (sequence.compare_exchange_weak(seq, seq + 1, memory_order_acquire, memory_order_relaxed)) {break;}
+        }
+        //the odd sequence is visible before any half changes
+        atomic_thread_fence(memory_order_release);
+        return seq + 1;
+    }
+
+    void unlock(uint32_t seq)
+    {
+        sequence.store(seq + 1, memory_order_release);
+        sequence.notify_all();
+    }
+
+    Word halves() const
+    {
+        return ((Word)high.load(memory_order_relaxed) << 32) | low.load(memory_order_relaxed);
+    }
+
+    void set_halves(Word value)
+    {
+        low.store((uint32_t)value, memory_order_relaxed);
+        high.store((uint32_t)(value >> 32), memory_order_relaxed);
+    }
+
+public:
+    explicit StatCell(Word initial = 0) : sequence(0), low((uint32_t)initial), high((uint32_t)(initial >> 32))
+    {
+    }
+
+    Word load() const
+    {
+        while (true)
+        {
+            uint32_t seq = sequence.load(memory_order_acquire);
+            if ((seq & 1) != 0)
+            {
+                sequence.wait(seq, memory_order_relaxed);
+                continue;
+            }
+            Word value = halves();
+            atomic_thread_fence(memory_order_acquire);
+            if (sequence.load(memory_order_relaxed) == seq) {return value;}
+        }
+    }
+
+    void store(Word value)
+    {
+        uint32_t seq = lock();
+        set_halves(value);
+        unlock(seq);
+    }
+
+    bool compare_exchange(Word& expected, Word desired)
+    {
+        uint32_t seq = lock();
+        Word current = halves();
+        bool swapped = current == expected;
+        if (swapped) {set_halves(desired);}
+        else {expected = current;}
+        unlock(seq);
+        return swapped;
+    }
+};
@@ -0,0 +1,1164 @@
+#include "store.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "checksum.h"
+#include "codec.h"
+
+static const char SEGMENT_MAGIC[8] = {'P', 'A', 'S', 'O', 'S', 'E', 'G', '1'};
+static const char MANIFEST_MAGIC[8] = {'P', 'A', 'S', 'O', 'M', 'A', 'N', 'I'};
+//also covers the record encoding, which the logs carry without a header
+static const uint32_t MANIFEST_VERSION = 2;
+
+//data blocks are cut at about this size, the sparse index has one entry per block
+static const size_t BLOCK_BYTES = 4096;
+static const size_t WRITE_BUFFER_BYTES = 1 << 20;
+static const uint64_t BLOOM_BITS_PER_KEY = 10;
+static const int BLOOM_HASHES = 7;
+
+//index offset, index count, bloom offset, bloom words, entry count, max id, crc, magic
+static const size_t FOOTER_SIZE = 8 + 4 + 8 + 4 + 8 + 8 + 4 + sizeof(SEGMENT_MAGIC);
+
+struct BlockIndex
+{
+    PetId first;
+    uint64_t offset;
+    uint32_t length;
+    uint32_t crc;
+};
+
+//an immutable sorted run of entries on disk. Only the index and the bloom
+//filter are kept in memory; the file is removed once a compaction has
+//replaced it and the last reader lets go.
+struct PetStore::Segment
+{
+    string path;
+    int fd = -1;
+    uint64_t file = 0;
+    int level = 0;
+    uint64_t entries = 0;
+    PetId max_id = 0;
+    vector<BlockIndex> index;
+    vector<uint64_t> bloom;
+    atomic<bool> obsolete{false};
+
+    ~Segment()
+    {
+        if (fd >= 0) {::close(fd);}
+        if (obsolete) {unlink(path.c_str());}
+    }
+
+    bool may_contain(PetId id) const;
+    bool read_block(size_t block, string& data) const;
+    bool find(PetId id, bool& deleted, string& bytes) const;
+};
+
+static uint64_t mix(PetId id)
+{
+    //splitmix64 finalizer
+    uint64_t x = id;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static string file_path(const string& dir, const char* prefix, uint64_t file, const char* suffix)
+{
+    return dir + "/" + prefix + to_string(file) + suffix;
+}
+
+static bool write_all(int fd, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR) {continue;}
+        if (n <= 0) {return false;}
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool read_all(int fd, char* data, size_t size, uint64_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t n = pread(fd, data, size, offset);
+        if (n < 0 && errno == EINTR) {continue;}
+        if (n <= 0) {return false;}
+        data += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static void sync_dir(const string& dir)
+{
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {return;}
+    fsync(fd);
+    ::close(fd);
+}
+
+//entries inside a block: id, deleted flag, length, encoded record
+static void put_entry(string& out, PetId id, bool deleted, string_view bytes)
+{
+    put_u64(out, id);
+    put_u8(out, deleted ? 1 : 0);
+    put_varint(out, bytes.size());
+    out.append(bytes);
+}
+
+static bool get_entry(string_view& in, PetId& id, bool& deleted, string_view& bytes)
+{
+    uint8_t flag;
+    uint64_t size;
+    if (!get_u64(in, id) || !get_u8(in, flag) || !get_varint(in, size) || !get_bytes(in, size, bytes)) {return false;}
+    deleted = flag != 0;
+    return true;
+}
+
+bool PetStore::Segment::may_contain(PetId id) const
+{
+    if (index.empty() || id < index[0].first || id > max_id) {return false;}
+
+    uint64_t bits = bloom.size() * 64;
+    uint64_t h1 = mix(id);
+    uint64_t h2 = (h1 >> 32) | 1;
+    for (int i = 0; i < BLOOM_HASHES; i++)
+    {
+        uint64_t bit = (h1 + i * h2) % bits;
+        if ((bloom[bit / 64] >> (bit % 64) & 1) == 0) {return false;}
+    }
+    return true;
+}
+
+bool PetStore::Segment::read_block(size_t block, string& data) const
+{
+    const BlockIndex& entry = index[block];
+    data.resize(entry.length);
+    if (!read_all(fd, data.data(), data.size(), entry.offset) || crc32c(data.data(), data.size()) != entry.crc)
+    {
+        cout << "Segment " << path << " has a bad block at " << entry.offset << endl;
+        return false;
+    }
+    return true;
+}
+
+bool PetStore::Segment::find(PetId id, bool& deleted, string& bytes) const
+{
+    if (!may_contain(id)) {return false;}
+
+    //the last block starting at or before id
+    auto it = upper_bound(index.begin(), index.end(), id, [](PetId key, const BlockIndex& block) {return key < block.first;});
+    string data;
+    if (!read_block(it - index.begin() - 1, data)) {return false;}
+
+    string_view rest(data);
+    PetId entry_id;
+    string_view value;
+    while (get_entry(rest, entry_id, deleted, value))
+    {
+        if (entry_id > id) {break;}
+        if (entry_id == id)
+        {
+            bytes.assign(value);
+            return true;
+        }
+    }
+    return false;
+}
+
+//streams sorted entries into a new segment file
+class SegmentWriter
+{
+private:
+    string path;
+    string tmp;
+    int fd = -1;
+    string buffer;
+    string block;
+    PetId block_first = 0;
+    uint64_t offset = 0;
+    vector<BlockIndex> index;
+    vector<uint64_t> hashes;
+    PetId last = 0;
+    bool ok = true;
+
+    void end_block()
+    {
+        if (block.empty()) {return;}
+        index.push_back(BlockIndex{block_first, offset, (uint32_t)block.size(), crc32c(block.data(), block.size())});
+        offset += block.size();
+        buffer.append(block);
+        block.clear();
+        if (buffer.size() >= WRITE_BUFFER_BYTES) {flush_buffer();}
+    }
+
+    void flush_buffer()
+    {
+        if (ok && !write_all(fd, buffer.data(), buffer.size())) {ok = false;}
+        buffer.clear();
+    }
+
+public:
+    ~SegmentWriter()
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+            unlink(tmp.c_str());
+        }
+    }
+
+    bool open(const string& file)
+    {
+        path = file;
+        tmp = file + ".tmp";
+        fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            cout << "Could not create segment " << tmp << endl;
+            return false;
+        }
+        return true;
+    }
+
+    size_t size() const
+    {
+        return hashes.size();
+    }
+
+    void add(PetId id, bool deleted, string_view bytes)
+    {
+        if (block.empty()) {block_first = id;}
+        put_entry(block, id, deleted, bytes);
+        hashes.push_back(mix(id));
+        last = id;
+        if (block.size() >= BLOCK_BYTES) {end_block();}
+    }
+
+    shared_ptr<PetStore::Segment> finish(uint64_t file, int level)
+    {
+        end_block();
+
+        auto segment = make_shared<PetStore::Segment>();
+        segment->path = path;
+        segment->file = file;
+        segment->level = level;
+        segment->entries = hashes.size();
+        segment->max_id = last;
+
+        uint64_t bits = max<uint64_t>(64, hashes.size() * BLOOM_BITS_PER_KEY);
+        segment->bloom.assign((bits + 63) / 64, 0);
+        bits = segment->bloom.size() * 64;
+        for (uint64_t h1 : hashes)
+        {
+            uint64_t h2 = (h1 >> 32) | 1;
+            for (int i = 0; i < BLOOM_HASHES; i++)
+            {
+                uint64_t bit = (h1 + i * h2) % bits;
+                segment->bloom[bit / 64] |= uint64_t(1) << (bit % 64);
+            }
+        }
+
+        //index and bloom filter follow the data, then a fixed size footer
+        string meta;
+        for (const BlockIndex& entry : index)
+        {
+            put_u64(meta, entry.first);
+            put_u64(meta, entry.offset);
+            put_u32(meta, entry.length);
+            put_u32(meta, entry.crc);
+        }
+        uint64_t bloom_offset = offset + meta.size();
+        for (uint64_t word : segment->bloom) {put_u64(meta, word);}
+
+        buffer.append(meta);
+        put_u64(buffer, offset);
+        put_u32(buffer, (uint32_t)index.size());
+        put_u64(buffer, bloom_offset);
+        put_u32(buffer, (uint32_t)segment->bloom.size());
+        put_u64(buffer, segment->entries);
+        put_u64(buffer, segment->max_id);
+        put_u32(buffer, crc32c(meta.data(), meta.size()));
+        buffer.append(SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+        flush_buffer();
+
+        if (!ok || fdatasync(fd) != 0 || ::close(fd) != 0 || rename(tmp.c_str(), path.c_str()) != 0)
+        {
+            if (fd >= 0) {::close(fd);}
+            fd = -1;
+            unlink(tmp.c_str());
+            cout << "Could not write segment " << path << endl;
+            return nullptr;
+        }
+        fd = -1;
+
+        segment->index = std::move(index);
+        segment->fd = ::open(path.c_str(), O_RDONLY);
+        if (segment->fd < 0)
+        {
+            cout << "Could not reopen segment " << path << endl;
+            return nullptr;
+        }
+        return segment;
+    }
+};
+
+static shared_ptr<PetStore::Segment> load_segment(const string& path, uint64_t file, int level)
+{
+    auto segment = make_shared<PetStore::Segment>();
+    segment->path = path;
+    segment->file = file;
+    segment->level = level;
+    segment->fd = ::open(path.c_str(), O_RDONLY);
+
+    struct stat info;
+    if (segment->fd < 0 || fstat(segment->fd, &info) != 0 || (uint64_t)info.st_size < FOOTER_SIZE)
+    {
+        cout << "Could not open segment " << path << endl;
+        return nullptr;
+    }
+
+    string footer(FOOTER_SIZE, '\0');
+    uint64_t index_offset;
+    uint32_t index_count;
+    uint64_t bloom_offset;
+    uint32_t bloom_words;
+    uint32_t meta_crc;
+    string_view view(footer);
+    string_view magic;
+    if (!read_all(segment->fd, footer.data(), footer.size(), info.st_size - FOOTER_SIZE)
+        || !get_u64(view, index_offset) || !get_u32(view, index_count)
+        || !get_u64(view, bloom_offset) || !get_u32(view, bloom_words)
+        || !get_u64(view, segment->entries) || !get_u64(view, segment->max_id) || !get_u32(view, meta_crc)
+        || !get_bytes(view, sizeof(SEGMENT_MAGIC), magic) || magic != string_view(SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC))
+        || bloom_offset != index_offset + (uint64_t)index_count * 24
+        || bloom_offset + (uint64_t)bloom_words * 8 + FOOTER_SIZE != (uint64_t)info.st_size)
+    {
+        cout << "Segment " << path << " has a bad footer" << endl;
+        return nullptr;
+    }
+
+    string meta(info.st_size - FOOTER_SIZE - index_offset, '\0');
+    if (!read_all(segment->fd, meta.data(), meta.size(), index_offset) || crc32c(meta.data(), meta.size()) != meta_crc)
+    {
+        cout << "Segment " << path << " has a bad index" << endl;
+        return nullptr;
+    }
+
+    view = meta;
+    segment->index.resize(index_count);
+    for (BlockIndex& entry : segment->index)
+    {
+        get_u64(view, entry.first);
+        get_u64(view, entry.offset);
+        get_u32(view, entry.length);
+        get_u32(view, entry.crc);
+    }
+    segment->bloom.resize(bloom_words);
+    for (uint64_t& word : segment->bloom) {get_u64(view, word);}
+    return segment;
+}
+
+//sorted entries from one source, merged by id with the newest source winning
+struct Cursor
+{
+    bool valid = false;
+    PetId id = 0;
+    bool deleted = false;
+    string_view bytes;
+
+    virtual ~Cursor() {}
+    virtual void next() = 0;
+};
+
+template <typename Map>
+struct TableCursor : Cursor
+{
+    typename Map::const_iterator it;
+    typename Map::const_iterator end;
+
+    TableCursor(const Map& entries, PetId from)
+    {
+        it = entries.lower_bound(from);
+        end = entries.end();
+        load();
+    }
+
+    void load()
+    {
+        valid = it != end;
+        if (!valid) {return;}
+        id = it->first;
+        deleted = it->second.deleted;
+        bytes = it->second.bytes;
+    }
+
+    void next() override
+    {
+        ++it;
+        load();
+    }
+};
+
+struct SegmentCursor : Cursor
+{
+    const PetStore::Segment& segment;
+    size_t block;
+    string data;
+    string_view rest;
+    bool ok = true;
+
+    SegmentCursor(const PetStore::Segment& segment, PetId from) : segment(segment)
+    {
+        if (segment.index.empty()) {return;}
+
+        //start in the last block beginning at or before from
+        auto it = upper_bound(segment.index.begin(), segment.index.end(), from,
+                              [](PetId key, const BlockIndex& entry) {return key < entry.first;});
+        block = it == segment.index.begin() ? 0 : it - segment.index.begin() - 1;
+        if (!segment.read_block(block, data))
+        {
+            ok = false;
+            return;
+        }
+        rest = data;
+
+        next();
+        while (valid && id < from) {next();}
+    }
+
+    void next() override
+    {
+        while (rest.empty())
+        {
+            block++;
+            if (block >= segment.index.size() || !segment.read_block(block, data))
+            {
+                if (block < segment.index.size()) {ok = false;}
+                valid = false;
+                return;
+            }
+            rest = data;
+        }
+        valid = get_entry(rest, id, deleted, bytes);
+        if (!valid) {ok = false;}
+    }
+};
+
+//visits each id below to once, from the first (newest) cursor holding it
+template <typename Fn>
+static void merge_cursors(const vector<Cursor*>& newest_first, PetId to, Fn fn)
+{
+    while (true)
+    {
+        Cursor* winner = nullptr;
+        for (Cursor* cursor : newest_first)
+        {
+            if (cursor->valid && cursor->id < to && (winner == nullptr || cursor->id < winner->id)) {winner = cursor;}
+        }
+        if (winner == nullptr) {return;}
+
+        PetId id = winner->id;
+        if (!fn(*winner)) {return;}
+        for (Cursor* cursor : newest_first)
+        {
+            if (cursor->valid && cursor->id == id) {cursor->next();}
+        }
+    }
+}
+
+PetStore::PetStore()
+{
+    wal_fd = -1;
+    next_file = 1;
+    work_pending = false;
+    stopping = false;
+    flushes = 0;
+    compactions = 0;
+    log_offset = 0;
+    log_appended = 0;
+    log_durable = 0;
+    log_busy = false;
+    log_failed = false;
+}
+
+PetStore::~PetStore()
+{
+    close();
+}
+
+uint64_t PetStore::log_floor() const
+{
+    //logs older than the oldest memtable not yet in a segment are obsolete
+    if (flushing) {return flushing->wal_file;}
+    if (active) {return active->wal_file;}
+    return next_file;
+}
+
+bool PetStore::save_manifest()
+{
+    string data(MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+    put_u32(data, MANIFEST_VERSION);
+    put_u64(data, next_file);
+    put_u64(data, log_floor());
+    put_u32(data, (uint32_t)segments.size());
+    for (const shared_ptr<Segment>& segment : segments)
+    {
+        put_u64(data, segment->file);
+        put_u8(data, (uint8_t)segment->level);
+    }
+    put_u32(data, crc32c(data.data(), data.size()));
+
+    string path = dir + "/MANIFEST";
+    string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && write_all(fd, data.data(), data.size()) && fdatasync(fd) == 0;
+    if (fd >= 0 && ::close(fd) != 0) {ok = false;}
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        cout << "Could not write manifest " << path << endl;
+        return false;
+    }
+    sync_dir(dir);
+    return true;
+}
+
+bool PetStore::load_manifest(uint64_t& floor)
+{
+    string path = dir + "/MANIFEST";
+    floor = 0;
+    if (!filesystem::exists(path)) {return true;}
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    string data;
+    if (fd >= 0 && fstat(fd, &info) == 0)
+    {
+        data.resize(info.st_size);
+        if (!read_all(fd, data.data(), data.size(), 0)) {data.clear();}
+    }
+    if (fd >= 0) {::close(fd);}
+
+    string_view view(data);
+    string_view magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t stored_crc = 0;
+    string_view trailer = view.size() >= 4 ? view.substr(view.size() - 4) : string_view();
+    if (!get_u32(trailer, stored_crc) || crc32c(data.data(), data.size() - 4) != stored_crc
+        || !get_bytes(view, sizeof(MANIFEST_MAGIC), magic) || magic != string_view(MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC))
+        || !get_u32(view, version) || version != MANIFEST_VERSION
+        || !get_u64(view, next_file) || !get_u64(view, floor) || !get_u32(view, count))
+    {
+        cout << "Manifest " << path << " is damaged" << endl;
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint64_t file;
+        uint8_t level;
+        if (!get_u64(view, file) || !get_u8(view, level)) {return false;}
+        shared_ptr<Segment> segment = load_segment(file_path(dir, "seg-", file, ".dat"), file, level);
+        if (!segment) {return false;}
+        segments.push_back(segment);
+    }
+    return true;
+}
+
+bool PetStore::open_wal(uint64_t file)
+{
+    string path = file_path(dir, "wal-", file, ".log");
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        cout << "Could not create log " << path << endl;
+        return false;
+    }
+    lock_guard<mutex> guard(log_lock);
+    if (wal_fd >= 0) {::close(wal_fd);}
+    wal_fd = fd;
+    log_offset = 0;
+    return true;
+}
+
+bool PetStore::replay_wal(const string& path, Memtable& table)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        if (fd >= 0) {::close(fd);}
+        cout << "Could not open log " << path << endl;
+        return false;
+    }
+    string data(info.st_size, '\0');
+    bool read = read_all(fd, data.data(), data.size(), 0);
+    ::close(fd);
+    if (!read) {return false;}
+
+    //a torn record at the end is what a crash mid-append leaves behind
+    string_view view(data);
+    uint32_t size;
+    uint32_t crc;
+    string_view payload;
+    while (get_u32(view, size) && get_u32(view, crc) && get_bytes(view, size, payload))
+    {
+        if (crc32c(payload.data(), payload.size()) != crc) {break;}
+
+        uint8_t deleted;
+        PetId id;
+        if (!get_u8(payload, deleted) || !get_u64(payload, id)) {break;}
+        Entry& entry = table.entries[id];
+        entry.deleted = deleted != 0;
+        entry.bytes.assign(payload);
+    }
+    return true;
+}
+
+bool PetStore::open(const string& directory)
+{
+    close();
+    dir = directory;
+    log_failed = false;
+
+    error_code error;
+    filesystem::create_directories(dir, error);
+    if (error)
+    {
+        cout << "Could not create store directory " << dir << endl;
+        return false;
+    }
+
+    uint64_t floor;
+    if (!load_manifest(floor))
+    {
+        segments.clear();
+        return false;
+    }
+
+    //clear out whatever an interrupted flush or compaction left behind
+    vector<pair<uint64_t, string>> logs;
+    for (const filesystem::directory_entry& entry : filesystem::directory_iterator(dir))
+    {
+        string name = entry.path().filename().string();
+        uint64_t file = 0;
+        bool is_segment = name.rfind("seg-", 0) == 0 && name.size() > 8 && name.substr(name.size() - 4) == ".dat";
+        bool is_log = name.rfind("wal-", 0) == 0 && name.size() > 8 && name.substr(name.size() - 4) == ".log";
+        if (is_segment || is_log) {file = strtoull(name.c_str() + 4, nullptr, 10);}
+
+        bool live = false;
+        if (is_segment)
+        {
+            for (const shared_ptr<Segment>& segment : segments) {live = live || segment->file == file;}
+        }
+        if (is_log && file >= floor)
+        {
+            logs.emplace_back(file, entry.path().string());
+            next_file = max(next_file, file + 1);
+            continue;
+        }
+        if (!live && name != "MANIFEST") {filesystem::remove(entry.path(), error);}
+    }
+    sort(logs.begin(), logs.end());
+
+    Memtable recovered;
+    for (const auto& log : logs)
+    {
+        if (!replay_wal(log.second, recovered)) {return false;}
+    }
+
+    uint64_t file = next_file++;
+    if (!open_wal(file)) {return false;}
+    active = make_shared<Memtable>();
+    active->wal_file = file;
+
+    if (!recovered.entries.empty())
+    {
+        shared_ptr<Segment> segment = write_segment(recovered, next_file++);
+        if (!segment) {return false;}
+        segments.push_back(segment);
+    }
+    if (!save_manifest()) {return false;}
+    for (const auto& log : logs) {unlink(log.second.c_str());}
+
+    stopping = false;
+    background = thread(&PetStore::background_loop, this);
+    return true;
+}
+
+void PetStore::close()
+{
+    if (background.joinable())
+    {
+        {
+            lock_guard<mutex> guard(work_lock);
+            stopping = true;
+        }
+        work_ready.notify_all();
+        background.join();
+    }
+
+    //a clean shutdown leaves everything in segments and no logs to replay
+    if (wal_fd >= 0)
+    {
+        lock_guard<mutex> guard(write_lock);
+        log_wait();
+        lock_guard<mutex> maintenance(maintenance_lock);
+        flush_pending();
+        {
+            unique_lock<shared_mutex> state(state_lock);
+            flushing = active;
+            active = nullptr;
+        }
+        flush_pending();
+        lock_guard<mutex> log_guard(log_lock);
+        ::close(wal_fd);
+        wal_fd = -1;
+    }
+
+    unique_lock<shared_mutex> state(state_lock);
+    active = nullptr;
+    flushing = nullptr;
+    segments.clear();
+    next_file = 1;
+}
+
+shared_ptr<PetStore::Segment> PetStore::write_segment(const Memtable& table, uint64_t file)
+{
+    SegmentWriter writer;
+    if (!writer.open(file_path(dir, "seg-", file, ".dat"))) {return nullptr;}
+    for (const auto& entry : table.entries)
+    {
+        writer.add(entry.first, entry.second.deleted, entry.second.bytes);
+    }
+    return writer.finish(file, 0);
+}
+
+bool PetStore::rotate()
+{
+    //the previous memtable has to be out before this one can take its place
+    {
+        unique_lock<shared_mutex> state(state_lock);
+        flushed.wait(state, [&] {return flushing == nullptr;});
+    }
+    //the old log is finished before the new one starts taking batches
+    if (!log_wait()) {return false;}
+
+    uint64_t file;
+    {
+        unique_lock<shared_mutex> state(state_lock);
+        file = next_file++;
+    }
+    if (!open_wal(file)) {return false;}
+
+    auto fresh = make_shared<Memtable>();
+    fresh->wal_file = file;
+    {
+        unique_lock<shared_mutex> state(state_lock);
+        flushing = active;
+        active = fresh;
+    }
+    {
+        lock_guard<mutex> guard(work_lock);
+        work_pending = true;
+    }
+    work_ready.notify_one();
+    return true;
+}
+
+bool PetStore::write(PetId id, bool deleted, const string& bytes)
+{
+    lock_guard<mutex> guard(write_lock);
+    if (wal_fd < 0) {return false;}
+    if (active->bytes >= MEMTABLE_BYTES && !rotate()) {return false;}
+
+    string record;
+    put_u32(record, (uint32_t)(bytes.size() + 9));
+    put_u32(record, 0);
+    put_u8(record, deleted ? 1 : 0);
+    put_u64(record, id);
+    record.append(bytes);
+    uint32_t crc = crc32c(record.data() + 8, record.size() - 8);
+    for (int i = 0; i < 4; i++) {record[4 + i] = (char)(crc >> (8 * i));}
+    if (!log_append(record)) {return false;}
+
+    unique_lock<shared_mutex> table(active->lock);
+    Entry& entry = active->entries[id];
+    if (entry.bytes.empty() && !entry.deleted) {active->bytes += sizeof(PetId) + 32;}
+    active->bytes += bytes.size();
+    active->bytes -= entry.bytes.size();
+    entry.deleted = deleted;
+    entry.bytes = bytes;
+    return true;
+}
+
+bool PetStore::put(const PetRecord& record)
+{
+    string bytes;
+    encode_record(record, bytes);
+    return write(record.id, false, bytes);
+}
+
+bool PetStore::put(PetId id, const PasoChan& pet, const TimerWheel* timers)
+{
+    return put(capture_pet(id, pet, timers));
+}
+
+bool PetStore::erase(PetId id)
+{
+    return write(id, true, string());
+}
+
+bool PetStore::log_append(const string& record)
+{
+    lock_guard<mutex> guard(log_lock);
+    if (log_failed) {return false;}
+    log_batch.append(record);
+    log_appended++;
+    log_submit();
+    return true;
+}
+
+//starts writing out the queued records unless a batch is already on its
+//way, with log_lock held
+void PetStore::log_submit()
+{
+    if (log_busy || log_batch.empty()) {return;}
+
+    auto batch = make_shared<string>();
+    batch->swap(log_batch);
+    uint64_t offset = log_offset;
+    uint64_t appended = log_appended;
+    log_offset += batch->size();
+    log_busy = true;
+    io.write_sync(wal_fd, offset, batch, [this, appended](bool ok) {log_done(appended, ok);});
+}
+
+//runs on the I/O thread when a batch is on disk, or failed to get there
+void PetStore::log_done(uint64_t appended, bool ok)
+{
+    vector<function<void(bool)>> ready;
+    bool failed;
+    {
+        lock_guard<mutex> guard(log_lock);
+        log_busy = false;
+        if (ok) {log_durable = appended;}
+        else if (!log_failed)
+        {
+            log_failed = true;
+            cout << "Could not write the store log" << endl;
+        }
+        failed = log_failed;
+
+        size_t kept = 0;
+        for (auto& waiter : log_waiters)
+        {
+            if (failed || waiter.first <= log_durable) {ready.push_back(std::move(waiter.second));}
+            else {log_waiters[kept++] = std::move(waiter);}
+        }
+        log_waiters.resize(kept);
+        if (!failed) {log_submit();}
+        //under the lock, once close() sees the log idle the store may be gone
+        log_written.notify_all();
+    }
+    for (const function<void(bool)>& done : ready) {done(!failed);}
+}
+
+bool PetStore::log_wait()
+{
+    unique_lock<mutex> guard(log_lock);
+    if (wal_fd < 0) {return false;}
+    uint64_t target = log_appended;
+    log_written.wait(guard, [&] {return log_failed || log_durable >= target;});
+    return !log_failed;
+}
+
+bool PetStore::sync()
+{
+    return log_wait();
+}
+
+void PetStore::when_durable(function<void(bool ok)> done)
+{
+    bool ok;
+    {
+        lock_guard<mutex> guard(log_lock);
+        ok = wal_fd >= 0 && !log_failed;
+        if (ok && log_durable < log_appended)
+        {
+            log_waiters.emplace_back(log_appended, std::move(done));
+            return;
+        }
+    }
+    done(ok);
+}
+
+bool PetStore::get(PetId id, PetRecord& record) const
+{
+    shared_ptr<Memtable> current;
+    shared_ptr<const Memtable> pending;
+    vector<shared_ptr<Segment>> runs;
+    {
+        shared_lock<shared_mutex> state(state_lock);
+        current = active;
+        pending = flushing;
+        runs = segments;
+    }
+
+    bool deleted = false;
+    string bytes;
+    bool found = false;
+    if (current)
+    {
+        shared_lock<shared_mutex> table(current->lock);
+        auto it = current->entries.find(id);
+        if (it != current->entries.end())
+        {
+            found = true;
+            deleted = it->second.deleted;
+            bytes = it->second.bytes;
+        }
+    }
+    if (!found && pending)
+    {
+        auto it = pending->entries.find(id);
+        if (it != pending->entries.end())
+        {
+            found = true;
+            deleted = it->second.deleted;
+            bytes = it->second.bytes;
+        }
+    }
+    for (size_t i = runs.size(); !found && i > 0; i--)
+    {
+        found = runs[i - 1]->find(id, deleted, bytes);
+    }
+
+    if (!found || deleted) {return false;}
+    string_view view(bytes);
+    return decode_record(view, record);
+}
+
+bool PetStore::scan(PetId from, PetId to, const function<bool(const PetRecord&)>& fn) const
+{
+    shared_ptr<Memtable> current;
+    shared_ptr<const Memtable> pending;
+    vector<shared_ptr<Segment>> runs;
+    {
+        shared_lock<shared_mutex> state(state_lock);
+        current = active;
+        pending = flushing;
+        runs = segments;
+    }
+
+    //the live memtable keeps changing, so scan a copy of the range
+    map<PetId, Entry> recent;
+    if (current)
+    {
+        shared_lock<shared_mutex> table(current->lock);
+        recent.insert(current->entries.lower_bound(from), current->entries.lower_bound(to));
+    }
+
+    vector<unique_ptr<Cursor>> cursors;
+    cursors.push_back(make_unique<TableCursor<map<PetId, Entry>>>(recent, from));
+    if (pending) {cursors.push_back(make_unique<TableCursor<map<PetId, Entry>>>(pending->entries, from));}
+    for (size_t i = runs.size(); i > 0; i--)
+    {
+        cursors.push_back(make_unique<SegmentCursor>(*runs[i - 1], from));
+    }
+
+    vector<Cursor*> order;
+    for (const unique_ptr<Cursor>& cursor : cursors) {order.push_back(cursor.get());}
+
+    bool ok = true;
+    PetRecord record;
+    merge_cursors(order, to, [&](const Cursor& cursor)
+    {
+        if (cursor.deleted) {return true;}
+        string_view view = cursor.bytes;
+        if (!decode_record(view, record))
+        {
+            ok = false;
+            return true;
+        }
+        return fn(record);
+    });
+
+    for (size_t i = cursors.size() - runs.size(); i < cursors.size(); i++)
+    {
+        if (!static_cast<SegmentCursor*>(cursors[i].get())->ok) {ok = false;}
+    }
+    return ok;
+}
+
+bool PetStore::flush_pending()
+{
+    shared_ptr<const Memtable> table;
+    uint64_t file;
+    {
+        unique_lock<shared_mutex> state(state_lock);
+        table = flushing;
+        if (!table) {return true;}
+        file = next_file++;
+    }
+
+    shared_ptr<Segment> segment;
+    if (!table->entries.empty())
+    {
+        segment = write_segment(*table, file);
+        if (!segment) {return false;}
+    }
+
+    bool saved;
+    {
+        unique_lock<shared_mutex> state(state_lock);
+        if (segment) {segments.push_back(segment);}
+        flushing = nullptr;
+        saved = save_manifest();
+    }
+    flushed.notify_all();
+    if (saved) {unlink(file_path(dir, "wal-", table->wal_file, ".log").c_str());}
+    flushes++;
+    return saved;
+}
+
+bool PetStore::compact_once()
+{
+    vector<shared_ptr<Segment>> runs;
+    {
+        shared_lock<shared_mutex> state(state_lock);
+        runs = segments;
+    }
+
+    //levels only go down from oldest to newest, so the oldest FANIN
+    //segments of a level are always next to each other
+    size_t start = runs.size();
+    for (int level = 0; start == runs.size() && level < 64; level++)
+    {
+        vector<size_t> at_level;
+        for (size_t i = 0; i < runs.size(); i++)
+        {
+            if (runs[i]->level == level) {at_level.push_back(i);}
+        }
+        if (at_level.size() >= COMPACT_FANIN) {start = at_level[0];}
+    }
+    if (start == runs.size()) {return false;}
+
+    vector<shared_ptr<Segment>> inputs(runs.begin() + start, runs.begin() + start + COMPACT_FANIN);
+    int level = inputs[0]->level + 1;
+    //nothing older can be hiding behind a tombstone
+    bool drop_deleted = start == 0;
+
+    uint64_t file;
+    {
+        unique_lock<shared_mutex> state(state_lock);
+        file = next_file++;
+    }
+
+    vector<unique_ptr<SegmentCursor>> cursors;
+    vector<Cursor*> order;
+    for (size_t i = inputs.size(); i > 0; i--)
+    {
+        cursors.push_back(make_unique<SegmentCursor>(*inputs[i - 1], 0));
+        order.push_back(cursors.back().get());
+    }
+
+    SegmentWriter writer;
+    if (!writer.open(file_path(dir, "seg-", file, ".dat"))) {return false;}
+    merge_cursors(order, ~PetId(0), [&](const Cursor& cursor)
+    {
+        if (!cursor.deleted || !drop_deleted) {writer.add(cursor.id, cursor.deleted, cursor.bytes);}
+        return true;
+    });
+    for (const unique_ptr<SegmentCursor>& cursor : cursors)
+    {
+        if (!cursor->ok) {return false;}
+    }
+
+    shared_ptr<Segment> merged;
+    if (writer.size() > 0)
+    {
+        merged = writer.finish(file, level);
+        if (!merged) {return false;}
+    }
+
+    {
+        unique_lock<shared_mutex> state(state_lock);
+        //flushes also hold maintenance_lock, so the list has not changed
+        auto first = segments.begin() + start;
+        first = segments.erase(first, first + COMPACT_FANIN);
+        if (merged) {segments.insert(first, merged);}
+        if (!save_manifest()) {return false;}
+    }
+    for (const shared_ptr<Segment>& input : inputs) {input->obsolete = true;}
+    compactions++;
+    return true;
+}
+
+void PetStore::background_loop()
+{
+    unique_lock<mutex> guard(work_lock);
+    while (!stopping)
+    {
+        //wakes up now and then to retry work that failed
+        work_ready.wait_for(guard, chrono::seconds(1), [&] {return stopping || work_pending;});
+        if (stopping) {break;}
+        work_pending = false;
+        guard.unlock();
+        {
+            lock_guard<mutex> maintenance(maintenance_lock);
+            if (flush_pending())
+            {
+                while (!stopping && compact_once()) {}
+            }
+        }
+        guard.lock();
+    }
+}
+
+void PetStore::settle()
+{
+    {
+        lock_guard<mutex> guard(write_lock);
+        if (wal_fd < 0) {return;}
+        bool empty;
+        {
+            shared_lock<shared_mutex> table(active->lock);
+            empty = active->entries.empty();
+        }
+        if (!empty) {rotate();}
+    }
+
+    lock_guard<mutex> maintenance(maintenance_lock);
+    if (flush_pending())
+    {
+        while (compact_once()) {}
+    }
+}
+
+StoreStats PetStore::stats() const
+{
+    StoreStats result;
+    shared_lock<shared_mutex> state(state_lock);
+    result.segments = segments.size();
+    result.memtable_bytes = 0;
+    if (active)
+    {
+        shared_lock<shared_mutex> table(active->lock);
+        result.memtable_bytes = active->bytes;
+    }
+    result.flushes = flushes;
+    result.compactions = compactions;
+    return result;
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ioqueue.h"
+#include "snapshot.h"
+
+struct StoreStats
+{
+    size_t segments;
+    size_t memtable_bytes;
+    uint64_t flushes;
+    uint64_t compactions;
+};
+
+//log-structured key-value storage for pet records, keyed by pet id.
+//Writes go to a write-ahead log and a sorted in-memory table; a full
+//table is written out by a background thread as an immutable sorted
+//segment with a sparse block index and a bloom filter. The same thread
+//merges runs of similar sized segments so lookups touch few files and
+//deleted pets are eventually dropped. Writers only wait when a table
+//fills before the previous one has been written out.
+//
+//The log is group committed: a write only queues its record, and records
+//queued while one batch is being written and synced go out together in
+//the next, through an IoQueue. A write is durable once sync() returns or
+//when_durable() calls back.
+class PetStore
+{
+public:
+    //a full memtable is swapped out at this size
+    static const size_t MEMTABLE_BYTES = 4 << 20;
+    //segments of the same level merged together into the next level
+    static const size_t COMPACT_FANIN = 4;
+
+    struct Segment;
+
+private:
+    struct Entry
+    {
+        bool deleted;
+        string bytes;       //encoded PetRecord
+    };
+
+    struct Memtable
+    {
+        mutable shared_mutex lock;
+        map<PetId, Entry> entries;
+        size_t bytes = 0;
+        uint64_t wal_file = 0;
+    };
+
+    string dir;
+    int wal_fd;
+
+    //segments oldest first, the order decides which version of a pet wins
+    mutable shared_mutex state_lock;
+    shared_ptr<Memtable> active;
+    shared_ptr<const Memtable> flushing;
+    vector<shared_ptr<Segment>> segments;
+    uint64_t next_file;
+
+    //writers wait on this (with state_lock) for a memtable to be written out
+    condition_variable_any flushed;
+    mutex write_lock;
+
+    //flushes and compactions run under this, normally on the background thread
+    mutex maintenance_lock;
+    thread background;
+    mutex work_lock;
+    condition_variable work_ready;
+    bool work_pending;
+    atomic<bool> stopping;
+
+    atomic<uint64_t> flushes;
+    atomic<uint64_t> compactions;
+
+    //log group commit state, wal_fd also only changes under log_lock
+    IoQueue io;
+    mutex log_lock;
+    condition_variable log_written;
+    string log_batch;                   //queued, not yet handed to io
+    uint64_t log_offset;
+    uint64_t log_appended;              //records queued so far
+    uint64_t log_durable;               //of those, records known to be on disk
+    bool log_busy;                      //a batch is being written
+    bool log_failed;
+    vector<pair<uint64_t, function<void(bool)>>> log_waiters;
+
+    bool log_append(const string& record);
+    void log_submit();
+    void log_done(uint64_t appended, bool ok);
+    bool log_wait();
+
+    bool write(PetId id, bool deleted, const string& bytes);
+    bool rotate();
+    bool open_wal(uint64_t file);
+    bool replay_wal(const string& path, Memtable& table);
+    uint64_t log_floor() const;
+    bool save_manifest();
+    bool load_manifest(uint64_t& floor);
+    shared_ptr<Segment> write_segment(const Memtable& table, uint64_t file);
+    bool flush_pending();
+    bool compact_once();
+    void background_loop();
+
+public:
+    PetStore();
+    ~PetStore();
+
+    PetStore(const PetStore&) = delete;
+    PetStore& operator=(const PetStore&) = delete;
+
+    //creates the directory if needed and replays any logs left by a crash
+    bool open(const string& directory);
+    void close();
+
+    bool put(const PetRecord& record);
+    bool put(PetId id, const PasoChan& pet, const TimerWheel* timers = nullptr);
+    bool erase(PetId id);
+
+    //false if the pet is not stored
+    bool get(PetId id, PetRecord& record) const;
+
+    //pets with from <= id < to in id order, stops early when fn returns false
+    bool scan(PetId from, PetId to, const function<bool(const PetRecord&)>& fn) const;
+
+    //blocks until every write so far is on disk. Must not be called from
+    //a when_durable() callback.
+    bool sync();
+    //calls done once every write so far is on disk, or the log has failed;
+    //right away if nothing is pending, otherwise from the I/O thread
+    void when_durable(function<void(bool ok)> done);
+
+    //blocks until the current memtable is a segment and compaction is idle
+    void settle();
+
+    StoreStats stats() const;
+};
@@ -0,0 +1,116 @@
+//checks that the steady-state read and update paths of a pet never reach
+//operator new. Build from the repo root and run; exits non-zero and names
+//the path if any of them allocates:
+//  g++ -std=c++20 -O2 -Isrc src/tests/alloc_harness.cpp $(ls src/*.cpp | grep -v main.cpp) -o alloc_harness
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "alerts.h"
+#include "owners.h"
+#include "pasochan.h"
+#include "rcu.h"
+#include "risk.h"
+
+static atomic<size_t> allocations{0};
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (size == 0) {size = 1;}
+    void* p = malloc(size);
+    if (p == nullptr) {throw bad_alloc();}
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+static const int ROUNDS = 1000;
+static int failures = 0;
+
+//runs fn once to warm up whatever it touches lazily, then counts the
+//allocations of ROUNDS more calls
+template <typename Fn>
+static void expect_no_allocations(const char* path, Fn fn)
+{
+    fn(0);
+    size_t before = allocations.load(memory_order_relaxed);
+    for (int i = 1; i <= ROUNDS; i++) {fn(i);}
+    size_t made = allocations.load(memory_order_relaxed) - before;
+
+    if (made != 0)
+    {
+        cout << path << ": " << made << " allocations in " << ROUNDS << " calls" << endl;
+        failures++;
+    }
+}
+
+static void exercise(PasoChan& pet, const char* label)
+{
+    cout << label << endl;
+    volatile int sink = 0;
+
+    expect_no_allocations("get_stats", [&](int) {sink = sink + pet.get_stats().health;});
+    expect_no_allocations("get_packed", [&](int) {sink = sink + (int)pet.get_packed();});
+    expect_no_allocations("get_health", [&](int) {sink = sink + pet.get_health();});
+    expect_no_allocations("get_owners", [&](int)
+    {
+        RcuReader reader;
+        sink = sink + (int)pet.get_owners().size();
+    });
+    expect_no_allocations("view", [&](int)
+    {
+        RcuReader reader;
+        PetView view = pet.view();
+        sink = sink + view.stats.hunger + (int)view.owners.size();
+    });
+    expect_no_allocations("is_owner", [&](int) {sink = sink + pet.is_owner("jake");});
+    expect_no_allocations("history", [&](int)
+    {
+        for (const HistoryEntry& entry : pet.history()) {sink = sink + entry.value;}
+    });
+
+    //alternate directions so the stats keep moving instead of sitting clamped
+    expect_no_allocations("apply", [&](int i)
+    {
+        int step = i % 2 == 0 ? 3 : -3;
+        sink = sink + pet.apply(Action{.health = step, .hunger = -step, .happiness = step, .stress = -step}).health;
+    });
+    expect_no_allocations("apply_fixed", [&](int i)
+    {
+        int step = i % 2 == 0 ? STAT_ONE * 3 / 2 : -STAT_ONE * 3 / 2;
+        sink = sink + pet.apply_fixed(FixedAction{.hunger = step, .stress = -step}).hunger;
+    });
+    expect_no_allocations("update_happiness", [&](int i) {sink = sink + pet.update_happiness(i % 2 == 0 ? 5 : -5);});
+}
+
+int main()
+{
+    PasoChan loose("bmo");
+    loose.add_owner("jake");
+    exercise(loose, "detached pet");
+
+    //the same paths with every hook a pet reports to on mutation
+    OwnerIndex owners;
+    AlertMonitor alerts;
+    RiskIndex risk;
+    alerts.set_threshold(HAPPINESS, BELOW, 50, 5);
+    PetHooks hooks{&owners, &alerts, &risk};
+
+    PasoChan hooked("bmo");
+    hooked.add_owner("jake");
+    hooked.attach(1, &hooks);
+    exercise(hooked, "attached pet");
+    hooked.detach();
+
+    if (failures != 0) {return 1;}
+    cout << "No allocations on the steady-state paths" << endl;
+    return 0;
+}
@@ -0,0 +1,167 @@
+//checks that a base and its deltas recover to the pool they were taken
+//from, that merging a chain leaves one base that recovers the same, and
+//that a damaged delta stops recovery there, blocks merging and makes the
+//next checkpoint a base. Build from the repo root and run; exits non-zero
+//and names the check if any of them fails:
+//  g++ -std=c++20 -O2 -Isrc src/tests/checkpoint_test.cpp $(ls src/*.cpp | grep -v main.cpp) -o checkpoint_test
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include "checkpoint.h"
+
+static const char* DIR = "/tmp/paso_checkpoint_test";
+static int failures = 0;
+
+static void expect(bool ok, const string& check)
+{
+    if (!ok)
+    {
+        cout << check << " failed" << endl;
+        failures++;
+    }
+}
+
+typedef unordered_map<PetId, StatWord> PoolState;
+
+static PoolState state_of(const PetPool& pool)
+{
+    PoolState state;
+    for (PasoChan* pet : pool.all())
+    {
+        if (pet != nullptr) {state[pet->get_id()] = pet->get_packed();}
+    }
+    return state;
+}
+
+static void expect_recovers(const PoolState& wanted, const string& label)
+{
+    PetRegistry registry;
+    if (!recover_checkpoints(DIR, registry, nullptr, nullptr))
+    {
+        cout << label << ": nothing recovered" << endl;
+        failures++;
+        return;
+    }
+    size_t wrong = registry.size() == wanted.size() ? 0 : 1;
+    for (const auto& [id, stats] : wanted)
+    {
+        PetHandle pet = registry.find(id);
+        if (!pet || pet->get_packed() != stats) {wrong++;}
+    }
+    if (wrong != 0)
+    {
+        cout << label << ": " << wrong << " pets differ, " << registry.size() << " recovered of " << wanted.size()
+             << endl;
+        failures++;
+    }
+}
+
+static size_t checkpoint_files()
+{
+    size_t files = 0;
+    for (const filesystem::directory_entry& entry : filesystem::directory_iterator(DIR))
+    {
+        if (entry.path().extension() == ".ckpt") {files++;}
+    }
+    return files;
+}
+
+static void poke(PetPool& pool, PetSlot from, PetSlot to, int step)
+{
+    for (PetSlot slot = from; slot < to; slot++)
+    {
+        PasoChan* pet = pool.get(slot);
+        if (pet != nullptr) {pet->apply(Action{.health = -step, .hunger = step});}
+    }
+}
+
+int main()
+{
+    filesystem::remove_all(DIR);
+
+    PetPool pool;
+    vector<PetSlot> slots;
+    for (PetId id = 0; id < 500; id++)
+    {
+        PetHandle pet = make_pet("pet" + to_string(id));
+        pet->attach(id, nullptr);
+        slots.push_back(pool.add(pet));
+    }
+
+    {
+        Checkpointer checkpoints(pool, DIR);
+        expect(checkpoints.open() && checkpoints.checkpoint() && checkpoints.settle(), "write base");
+        expect(checkpoints.last_written() == 500, "base holds every pet");
+
+        //changed, removed and added pets go into the deltas
+        poke(pool, 0, 50, 3);
+        for (PetId id = 490; id < 500; id++) {pool.remove(slots[id]);}
+        for (PetId id = 1000; id < 1010; id++)
+        {
+            PetHandle pet = make_pet("pet" + to_string(id));
+            pet->attach(id, nullptr);
+            pool.add(pet);
+        }
+        expect(checkpoints.checkpoint() && checkpoints.settle(), "write first delta");
+        poke(pool, 25, 100, 5);
+        expect(checkpoints.checkpoint() && checkpoints.settle(), "write second delta");
+        expect(checkpoints.last_written() == 75, "delta holds only changed pets");
+    }
+    PoolState chained = state_of(pool);
+    expect(checkpoint_files() == 3, "base and two deltas on disk");
+    expect_recovers(chained, "chain");
+
+    expect(merge_checkpoints(DIR), "merge");
+    expect(checkpoint_files() == 1, "merge leaves only the new base");
+    expect_recovers(chained, "merged chain");
+
+    //two more deltas on the merged base, the first then damaged
+    Checkpointer checkpoints(pool, DIR);
+    expect(checkpoints.open(), "open merged chain");
+    poke(pool, 100, 200, 7);
+    expect(checkpoints.checkpoint() && checkpoints.settle(), "write delta on merged base");
+    poke(pool, 200, 300, 7);
+    expect(checkpoints.checkpoint() && checkpoints.settle(), "write delta after it");
+
+    string damaged;
+    uint64_t damaged_seq = ~uint64_t(0);
+    for (const filesystem::directory_entry& entry : filesystem::directory_iterator(DIR))
+    {
+        string name = entry.path().filename().string();
+        if (name.rfind("delta-", 0) != 0) {continue;}
+        uint64_t seq = stoull(name.substr(6));
+        if (seq < damaged_seq)
+        {
+            damaged = entry.path();
+            damaged_seq = seq;
+        }
+    }
+    {
+        fstream file(damaged, ios::in | ios::out | ios::binary);
+        file.seekg(0, ios::end);
+        streamoff size = file.tellg();
+        char byte;
+        file.seekg(size / 2);
+        file.read(&byte, 1);
+        byte ^= 0x5a;
+        file.seekp(size / 2);
+        file.write(&byte, 1);
+        expect(bool(file), "damage first delta");
+    }
+
+    //recovery stops at the damaged delta, nothing from it or after it
+    expect_recovers(chained, "chain with a damaged delta");
+    expect(!merge_checkpoints(DIR), "refuse to merge a damaged chain");
+    expect(checkpoint_files() == 3, "failed merge deletes nothing");
+
+    Checkpointer reopened(pool, DIR);
+    expect(reopened.open() && reopened.checkpoint() && reopened.settle(), "checkpoint after damage");
+    expect(reopened.last_written() == pool.size(), "checkpoint after damage is a base");
+    expect_recovers(state_of(pool), "fresh base");
+
+    filesystem::remove_all(DIR);
+    if (failures != 0) {return 1;}
+    cout << "Checkpoint chains recover, merge and survive a damaged delta" << endl;
+    return 0;
+}
@@ -0,0 +1,103 @@
+//checks that compress() round-trips data of every shape through both
+//decompress() and a Decompressor fed in pieces, and that truncated or
+//damaged streams and frames are rejected. Build from the repo root and
+//run; exits non-zero and names the check if any of them fails:
+//  g++ -std=c++20 -O2 -Isrc src/tests/compress_test.cpp $(ls src/*.cpp | grep -v main.cpp) -o compress_test
+#include <iostream>
+#include <vector>
+#include "compress.h"
+
+static int failures = 0;
+
+static void expect(bool ok, const string& check)
+{
+    if (!ok)
+    {
+        cout << check << " failed" << endl;
+        failures++;
+    }
+}
+
+static void round_trip(const string& name, const string& data)
+{
+    string packed;
+    compress(data, packed);
+    string unpacked;
+    expect(decompress(packed, unpacked) && unpacked == data, name + ": decompress");
+
+    //fed in uneven pieces, as a relay would hand them over
+    Decompressor stream;
+    string streamed;
+    bool ok = true;
+    for (size_t at = 0, step = 1; at < packed.size() && ok; at += step, step = step * 3 + 1)
+    {
+        ok = stream.feed(string_view(packed).substr(at, step), streamed);
+    }
+    expect(ok && stream.done() && streamed == data, name + ": streamed");
+
+    //every proper prefix is incomplete, never a shorter valid stream
+    for (size_t size = 0; size < packed.size(); size = size < 64 ? size + 1 : size * 2)
+    {
+        string partial;
+        if (decompress(string_view(packed).substr(0, size), partial))
+        {
+            cout << name << ": stream cut at " << size << " of " << packed.size() << " bytes decodes" << endl;
+            failures++;
+            break;
+        }
+    }
+}
+
+int main()
+{
+    uint32_t seed = 7;
+    auto next = [&] {seed = seed * 1103515245 + 12345; return seed >> 16;};
+
+    round_trip("empty", "");
+    round_trip("one byte", "x");
+    round_trip("short", "bmo");
+    round_trip("run", string(100000, 'a'));
+
+    string noise(3 * BLOCK_SIZE + 17, 0);
+    for (char& c : noise) {c = (char)next();}
+    round_trip("incompressible", noise);
+
+    //pet records repeat owner names and sit on the same few values
+    string records;
+    while (records.size() < 2 * BLOCK_SIZE + 1000)
+    {
+        records += "pet " + to_string(next() % 5000) + " owners jake,finn stats 100 " + to_string(next() % 4) +
+                   " 75 20\n";
+    }
+    round_trip("records", records);
+
+    //matches right at the block edges and the longest offsets
+    string edges(BLOCK_SIZE * 2, 0);
+    for (size_t i = 0; i < edges.size(); i++) {edges[i] = i < 65535 ? (char)next() : edges[i - 65535];}
+    round_trip("far matches", edges);
+
+    string packed;
+    compress(records, packed);
+    string out;
+    string damaged = packed;
+    damaged[damaged.size() / 2] ^= 0x55;
+    damaged[damaged.size() / 2 + 1] ^= 0x55;
+    //damage inside a block may still decode but must not run off the end
+    decompress(damaged, out);
+    string tail = packed + "x";
+    out.clear();
+    expect(!decompress(tail, out), "reject bytes after the end of the stream");
+
+    string frame;
+    encode_frame(records, true, frame);
+    string payload;
+    expect(decode_frame(frame, payload) && payload == records, "compressed frame");
+    encode_frame("bmo", false, frame);
+    payload.clear();
+    expect(decode_frame(frame, payload) && payload == "bmo", "stored frame");
+    expect(!decode_frame(string_view(frame).substr(0, frame.size() - 1), payload), "reject truncated frame");
+
+    if (failures != 0) {return 1;}
+    cout << "Compression round-trips and rejects truncated input" << endl;
+    return 0;
+}
@@ -0,0 +1,108 @@
+//checks that a SeriesStore file cut off anywhere inside its last block,
+//as a crash mid-write leaves it, reopens with that block dropped, the
+//earlier blocks intact and the file trimmed so new blocks follow them.
+//Build from the repo root and run; exits non-zero and names the check if
+//any of them fails:
+//  g++ -std=c++20 -O2 -Isrc src/tests/series_test.cpp $(ls src/*.cpp | grep -v main.cpp) -o series_test
+#include <filesystem>
+#include <iostream>
+#include "series.h"
+
+static const char* PATH = "/tmp/paso_series_test.bin";
+static const char* INTACT = "/tmp/paso_series_test.intact";
+static const SimTime MINUTE_MS = 60000;
+static int failures = 0;
+
+static void expect(bool ok, const string& check)
+{
+    if (!ok)
+    {
+        cout << check << " failed" << endl;
+        failures++;
+    }
+}
+
+static Stats stats_at(PetId pet, int i)
+{
+    return Stats{.health = 100 - i % 40, .hunger = (int)(pet * 7 + i / 3) % 100, .happiness = 50, .stress = i % 2};
+}
+
+static void append_run(SeriesStore& series, PetId pet, int from, int to)
+{
+    for (int i = from; i < to; i++) {series.append(pet, i * MINUTE_MS, stats_at(pet, i));}
+}
+
+//pet's samples should be exactly from..to
+static void expect_run(const SeriesStore& series, PetId pet, int from, int to, const string& label)
+{
+    vector<StatSample> samples;
+    bool read = series.samples(pet, 0, to * MINUTE_MS + 1, samples);
+    bool same = read && samples.size() == size_t(to - from);
+    for (size_t i = 0; same && i < samples.size(); i++)
+    {
+        Stats wanted = stats_at(pet, from + (int)i);
+        const StatSample& got = samples[i];
+        same = got.time == (from + (int)i) * MINUTE_MS && got.stats.health == wanted.health &&
+               got.stats.hunger == wanted.hunger && got.stats.stress == wanted.stress;
+    }
+    if (!same)
+    {
+        cout << label << ": pet " << pet << " has " << samples.size() << " samples, wanted " << to - from << endl;
+        failures++;
+    }
+}
+
+int main()
+{
+    filesystem::remove(PATH);
+
+    uint64_t kept_size;
+    uint64_t full_size;
+    {
+        SeriesStore series;
+        expect(series.open(PATH), "create");
+        for (PetId pet = 1; pet <= 3; pet++) {append_run(series, pet, 0, 500);}
+        expect(series.flush(), "first flush");
+        kept_size = filesystem::file_size(PATH);
+
+        //the block a crash will tear, the only one written by this flush
+        append_run(series, 2, 500, 800);
+        expect(series.flush(), "second flush");
+        full_size = filesystem::file_size(PATH);
+    }
+    filesystem::copy_file(PATH, INTACT, filesystem::copy_options::overwrite_existing);
+
+    //inside the block header, just past it, mid-sections, one byte short
+    for (uint64_t cut : {kept_size + 1, kept_size + 20, kept_size + (full_size - kept_size) / 2, full_size - 1})
+    {
+        filesystem::copy_file(INTACT, PATH, filesystem::copy_options::overwrite_existing);
+        filesystem::resize_file(PATH, cut);
+        string label = "cut at " + to_string(cut);
+
+        SeriesStore series;
+        expect(series.open(PATH), label + ": open");
+        expect(filesystem::file_size(PATH) == kept_size, label + ": torn block trimmed");
+        expect(series.block_count() == 3, label + ": complete blocks kept");
+        for (PetId pet = 1; pet <= 3; pet++) {expect_run(series, pet, 0, 500, label);}
+    }
+
+    //blocks written after the cut are found on the next open
+    {
+        SeriesStore series;
+        expect(series.open(PATH), "reopen to append");
+        append_run(series, 2, 500, 600);
+        expect(series.flush(), "flush after the cut");
+    }
+    {
+        SeriesStore series;
+        expect(series.open(PATH), "reopen after appending");
+        expect(series.block_count() == 4, "new block follows the kept ones");
+        expect_run(series, 2, 0, 600, "appended after the cut");
+    }
+
+    filesystem::remove(PATH);
+    filesystem::remove(INTACT);
+    if (failures != 0) {return 1;}
+    cout << "Torn series blocks are cut off" << endl;
+    return 0;
+}
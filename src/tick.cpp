@@ -0,0 +1,129 @@
+#include "tick.h"
+#include "columns.h"
+#include "replay.h"
+#include <chrono>
+
+typedef chrono::steady_clock WallClock;
+
+static double ms_since(WallClock::time_point start)
+{
+    return chrono::duration<double, milli>(WallClock::now() - start).count();
+}
+
+TickEngine::TickEngine(PetPool& pool, WorkerPool& workers, SimTime period_ms) : pool(pool), workers(workers)
+{
+    rules = nullptr;
+    timers = nullptr;
+    period = period_ms;
+    ticks = 0;
+    recorder = nullptr;
+}
+
+void TickEngine::set_decay(const Action& per_tick)
+{
+    set_fixed_decay(to_fixed(per_tick));
+}
+
+void TickEngine::set_fixed_decay(const FixedAction& per_tick)
+{
+    decay = per_tick;
+    if (recorder != nullptr) {recorder->engine(period, decay);}
+}
+
+void TickEngine::set_rules(const RuleSet* rule_set)
+{
+    rules = rule_set;
+}
+
+void TickEngine::set_period(SimTime period_ms)
+{
+    period = period_ms;
+    if (recorder != nullptr) {recorder->engine(period, decay);}
+}
+
+void TickEngine::set_recorder(InputRecorder* inputs)
+{
+    recorder = inputs;
+    if (recorder != nullptr) {recorder->engine(period, decay);}
+}
+
+void TickEngine::set_timers(TimerWheel* wheel, function<void(const TimerEvent&)> handler)
+{
+    timers = wheel;
+    on_timer = std::move(handler);
+}
+
+SimTime TickEngine::get_period() const
+{
+    return period;
+}
+
+uint64_t TickEngine::get_ticks() const
+{
+    return ticks;
+}
+
+void TickEngine::run_chunk(size_t chunk)
+{
+    span<PasoChan* const> pets = pool.chunk(chunk);
+
+    bool decays = decay.health != 0 || decay.hunger != 0 || decay.happiness != 0 || decay.stress != 0;
+    if (decays)
+    {
+        for (PasoChan* pet : pets)
+        {
+            if (pet != nullptr) {pet->apply_fixed_derived(decay);}
+        }
+    }
+
+    if (rules != nullptr) {rules->run(pets);}
+
+    ColumnStore* columns = pool.get_columns();
+    if (columns != nullptr)
+    {
+        size_t begin = chunk * PetPool::CHUNK_SIZE;
+        columns->run_decay(begin, begin + pets.size());
+    }
+}
+
+TickReport TickEngine::tick()
+{
+    //before the clock moves, see InputRecorder::tick()
+    if (recorder != nullptr) {recorder->tick();}
+    WallClock::time_point start = WallClock::now();
+
+    size_t chunks = pool.chunk_count();
+    vector<double> chunk_ms(chunks, 0.0);
+
+    workers.parallel_for(chunks, [&](size_t chunk)
+    {
+        WallClock::time_point chunk_start = WallClock::now();
+        run_chunk(chunk);
+        chunk_ms[chunk] = ms_since(chunk_start);
+    });
+
+    ticks++;
+
+    TickReport report;
+    report.tick = ticks;
+    report.time = sim_advance(period);
+
+    //expired timers are processed as one batch
+    expired.clear();
+    if (timers != nullptr) {timers->advance(report.time, expired);}
+    if (on_timer)
+    {
+        for (const TimerEvent& event : expired) {on_timer(event);}
+    }
+    report.timers_fired = expired.size();
+    report.pets = pool.size();
+    report.chunks = chunks;
+    report.threads = workers.thread_count();
+    report.stolen = workers.last_stolen();
+    report.elapsed_ms = ms_since(start);
+    report.slowest_chunk_ms = 0;
+    for (double ms : chunk_ms) {report.slowest_chunk_ms = max(report.slowest_chunk_ms, ms);}
+    report.budget_ms = (double)period;
+    report.over_budget = report.elapsed_ms > report.budget_ms;
+    return report;
+}
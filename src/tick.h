@@ -0,0 +1,72 @@
+#pragma once
+#include "clock.h"
+#include "pasochan.h"
+#include "pool.h"
+#include "rules.h"
+#include "timers.h"
+#include "workers.h"
+
+class InputRecorder;
+
+//what one tick cost, compared against the tick period
+struct TickReport
+{
+    uint64_t tick;
+    SimTime time;
+    size_t pets;
+    size_t chunks;
+    size_t threads;
+    size_t stolen;
+    size_t timers_fired;
+    double elapsed_ms;
+    double slowest_chunk_ms;
+    double budget_ms;
+    bool over_budget;
+};
+
+//advances the simulation one period at a time. Each tick the pool's
+//chunks are handed to the worker pool; for every pet decay is applied,
+//then the rules run, then any runtime stat columns decay. A pet is only
+//ever touched by the task that owns its chunk, so the result does not
+//depend on the thread count.
+class TickEngine
+{
+private:
+    PetPool& pool;
+    WorkerPool& workers;
+    const RuleSet* rules;
+    TimerWheel* timers;
+    function<void(const TimerEvent&)> on_timer;
+    vector<TimerEvent> expired;
+    FixedAction decay;
+    SimTime period;
+    uint64_t ticks;
+    InputRecorder* recorder;
+
+    void run_chunk(size_t chunk);
+
+public:
+    TickEngine(PetPool& pool, WorkerPool& workers, SimTime period_ms);
+
+    //stat change every pet takes each tick
+    void set_decay(const Action& per_tick);
+    //the same in fixed point, for rates slower than a point per tick
+    void set_fixed_decay(const FixedAction& per_tick);
+    //rules are not owned and may be nullptr
+    void set_rules(const RuleSet* rule_set);
+    void set_period(SimTime period_ms);
+
+    //records every tick, and the period and decay now and whenever they
+    //change, may be nullptr to stop. Rules are not recorded.
+    void set_recorder(InputRecorder* inputs);
+
+    //timers due by the end of each tick are handed to handler in due order,
+    //on the ticking thread, after the parallel pass
+    void set_timers(TimerWheel* wheel, function<void(const TimerEvent&)> handler);
+
+    SimTime get_period() const;
+    uint64_t get_ticks() const;
+
+    //runs one tick and moves the sim clock forward by the period
+    TickReport tick();
+};
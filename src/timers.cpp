@@ -0,0 +1,234 @@
+#include "timers.h"
+#include <algorithm>
+
+TimerWheel::TimerWheel(SimTime resolution_ms, SimTime start)
+{
+    resolution = resolution_ms > 0 ? resolution_ms : 1;
+    now_tick = start / resolution;
+    free_head = NIL;
+    live = 0;
+    for (int l = 0; l < LEVELS; l++)
+    {
+        for (uint32_t s = 0; s < SLOTS; s++) {heads[l][s] = NIL;}
+    }
+}
+
+void TimerWheel::place(uint32_t index)
+{
+    Node& node = nodes[index];
+
+    //lowest level whose slot ring still reaches the due tick
+    int level = LEVELS - 1;
+    uint32_t slot = (uint32_t)((now_tick >> (SLOT_BITS * level)) + SLOTS - 1) & (SLOTS - 1);
+    for (int l = 0; l < LEVELS; l++)
+    {
+        int shift = SLOT_BITS * l;
+        if ((node.due_tick >> shift) - (now_tick >> shift) < SLOTS)
+        {
+            level = l;
+            slot = (uint32_t)(node.due_tick >> shift) & (SLOTS - 1);
+            break;
+        }
+    }
+
+    node.level = (uint8_t)level;
+    node.slot = (uint8_t)slot;
+    node.prev = NIL;
+    node.next = heads[level][slot];
+    if (node.next != NIL) {nodes[node.next].prev = index;}
+    heads[level][slot] = index;
+}
+
+void TimerWheel::unlink_slot(uint32_t index)
+{
+    Node& node = nodes[index];
+    if (node.prev != NIL) {nodes[node.prev].next = node.next;}
+    else {heads[node.level][node.slot] = node.next;}
+    if (node.next != NIL) {nodes[node.next].prev = node.prev;}
+}
+
+void TimerWheel::unlink_pet(uint32_t index)
+{
+    Node& node = nodes[index];
+    if (node.pet_next != NIL) {nodes[node.pet_next].pet_prev = node.pet_prev;}
+    if (node.pet_prev != NIL)
+    {
+        nodes[node.pet_prev].pet_next = node.pet_next;
+    }
+    else if (node.pet_next != NIL)
+    {
+        pet_heads[node.pet] = node.pet_next;
+    }
+    else
+    {
+        pet_heads.erase(node.pet);
+    }
+}
+
+void TimerWheel::release(uint32_t index)
+{
+    Node& node = nodes[index];
+    node.live = false;
+    node.generation++;
+    node.next = free_head;
+    free_head = index;
+    live--;
+}
+
+TimerEvent TimerWheel::event_for(uint32_t index) const
+{
+    const Node& node = nodes[index];
+    return TimerEvent{(TimerId)node.generation << 32 | index, node.pet, node.kind, node.due};
+}
+
+void TimerWheel::cascade(int level, uint32_t slot)
+{
+    uint32_t index = heads[level][slot];
+    heads[level][slot] = NIL;
+    while (index != NIL)
+    {
+        uint32_t next = nodes[index].next;
+        place(index);
+        index = next;
+    }
+}
+
+TimerId TimerWheel::schedule(PetId pet, uint16_t kind, SimTime due)
+{
+    lock_guard<mutex> guard(lock);
+
+    uint32_t index;
+    if (free_head != NIL)
+    {
+        index = free_head;
+        free_head = nodes[index].next;
+    }
+    else
+    {
+        index = (uint32_t)nodes.size();
+        nodes.emplace_back();
+        nodes[index].generation = 0;
+    }
+
+    Node& node = nodes[index];
+    node.pet = pet;
+    node.kind = kind;
+    node.due = due;
+    node.due_tick = (due + resolution - 1) / resolution;
+    if (node.due_tick <= now_tick) {node.due_tick = now_tick + 1;}
+    node.live = true;
+    place(index);
+
+    //newest timer goes to the front of the pet's chain
+    auto head = pet_heads.find(pet);
+    node.pet_prev = NIL;
+    node.pet_next = head != pet_heads.end() ? head->second : NIL;
+    if (node.pet_next != NIL) {nodes[node.pet_next].pet_prev = index;}
+    pet_heads[pet] = index;
+
+    live++;
+    return (TimerId)node.generation << 32 | index;
+}
+
+bool TimerWheel::cancel(TimerId id)
+{
+    lock_guard<mutex> guard(lock);
+
+    uint32_t index = (uint32_t)id;
+    if (index >= nodes.size()) {return false;}
+    Node& node = nodes[index];
+    if (!node.live || node.generation != (uint32_t)(id >> 32)) {return false;}
+
+    unlink_slot(index);
+    unlink_pet(index);
+    release(index);
+    return true;
+}
+
+size_t TimerWheel::cancel_all(PetId pet)
+{
+    lock_guard<mutex> guard(lock);
+
+    auto head = pet_heads.find(pet);
+    if (head == pet_heads.end()) {return 0;}
+
+    size_t count = 0;
+    uint32_t index = head->second;
+    pet_heads.erase(head);
+    while (index != NIL)
+    {
+        uint32_t next = nodes[index].pet_next;
+        unlink_slot(index);
+        release(index);
+        index = next;
+        count++;
+    }
+    return count;
+}
+
+size_t TimerWheel::advance(SimTime now, vector<TimerEvent>& expired)
+{
+    lock_guard<mutex> guard(lock);
+
+    uint64_t target = now / resolution;
+    size_t first = expired.size();
+
+    while (now_tick < target)
+    {
+        //nothing pending, jump straight there
+        if (live == 0)
+        {
+            now_tick = target;
+            break;
+        }
+
+        now_tick++;
+
+        //refill lower levels when a coarser slot comes due, coarsest first
+        for (int level = LEVELS - 1; level > 0; level--)
+        {
+            uint64_t mask = ((uint64_t)1 << (SLOT_BITS * level)) - 1;
+            if ((now_tick & mask) == 0)
+            {
+                cascade(level, (uint32_t)(now_tick >> (SLOT_BITS * level)) & (SLOTS - 1));
+            }
+        }
+
+        uint32_t slot = (uint32_t)now_tick & (SLOTS - 1);
+        uint32_t index = heads[0][slot];
+        heads[0][slot] = NIL;
+        while (index != NIL)
+        {
+            uint32_t next = nodes[index].next;
+            expired.push_back(event_for(index));
+            unlink_pet(index);
+            release(index);
+            index = next;
+        }
+    }
+
+    sort(expired.begin() + first, expired.end(), [](const TimerEvent& a, const TimerEvent& b)
+    {
+        if (a.due != b.due) {return a.due < b.due;}
+        return (uint32_t)a.id < (uint32_t)b.id;
+    });
+    return expired.size() - first;
+}
+
+void TimerWheel::pending(PetId pet, vector<TimerEvent>& out) const
+{
+    lock_guard<mutex> guard(lock);
+
+    auto head = pet_heads.find(pet);
+    if (head == pet_heads.end()) {return;}
+    for (uint32_t index = head->second; index != NIL; index = nodes[index].pet_next)
+    {
+        out.push_back(event_for(index));
+    }
+}
+
+size_t TimerWheel::size() const
+{
+    lock_guard<mutex> guard(lock);
+    return live;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <mutex>
+#include <unordered_map>
+#include "clock.h"
+#include "pasochan.h"
+
+//what a pet timer is for, stored as a plain number so new kinds do not
+//change the snapshot format
+enum PetEventKind : uint16_t
+{
+    HUNGER_REMINDER,
+    BEDTIME,
+    WAKE_UP,
+    SICKNESS_CHECK
+};
+
+typedef uint64_t TimerId;
+
+struct TimerEvent
+{
+    TimerId id;
+    PetId pet;
+    uint16_t kind;
+    SimTime due;
+};
+
+//hierarchical timing wheel: 4 levels of 256 slots, each level 256 times
+//coarser than the one below. Timers sit in intrusive lists, so schedule and
+//cancel are O(1), and a timer is touched at most once per level on its way
+//down before it expires. Pending timers are also chained per pet so they
+//can be saved with (or dropped along with) the pet.
+class TimerWheel
+{
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 8;
+    static const uint32_t SLOTS = 1 << SLOT_BITS;
+    static const uint32_t NIL = ~uint32_t(0);
+
+    struct Node
+    {
+        PetId pet;
+        SimTime due;
+        uint64_t due_tick;
+        uint32_t generation;
+        uint32_t prev, next;            //slot list, or free list via next
+        uint32_t pet_prev, pet_next;
+        uint16_t kind;
+        uint8_t level;
+        bool live;
+        uint8_t slot;
+    };
+
+    mutable mutex lock;
+    SimTime resolution;
+    uint64_t now_tick;
+    vector<Node> nodes;
+    uint32_t free_head;
+    uint32_t heads[LEVELS][SLOTS];
+    unordered_map<PetId, uint32_t> pet_heads;
+    size_t live;
+
+    void place(uint32_t index);
+    void unlink_slot(uint32_t index);
+    void unlink_pet(uint32_t index);
+    void release(uint32_t index);
+    void cascade(int level, uint32_t slot);
+    TimerEvent event_for(uint32_t index) const;
+
+public:
+    //resolution_ms is the wheel's tick, timers fire on the first tick at or after their due time
+    explicit TimerWheel(SimTime resolution_ms = 1000, SimTime start = 0);
+
+    TimerId schedule(PetId pet, uint16_t kind, SimTime due);
+    bool cancel(TimerId id);
+    size_t cancel_all(PetId pet);
+
+    //fires every timer due up to now and appends them to expired, ordered by due time
+    size_t advance(SimTime now, vector<TimerEvent>& expired);
+
+    void pending(PetId pet, vector<TimerEvent>& out) const;
+    size_t size() const;
+};
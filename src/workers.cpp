@@ -0,0 +1,143 @@
+#include "workers.h"
+
+WorkerPool::WorkerPool(size_t workers)
+{
+    if (workers == 0)
+    {
+        size_t hw = thread::hardware_concurrency();
+        workers = hw > 1 ? hw - 1 : 0;
+    }
+
+    queues = vector<Queue>(workers + 1);
+    job = nullptr;
+    generation = 0;
+    active = 0;
+    stopping = false;
+
+    for (size_t i = 0; i < workers; i++)
+    {
+        threads.emplace_back(&WorkerPool::worker_loop, this, i);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        lock_guard<mutex> guard(job_lock);
+        stopping = true;
+    }
+    job_ready.notify_all();
+    for (thread& t : threads) {t.join();}
+}
+
+size_t WorkerPool::thread_count() const
+{
+    return queues.size();
+}
+
+void WorkerPool::worker_loop(size_t self)
+{
+    uint64_t seen = 0;
+    while (true)
+    {
+        unique_lock<mutex> guard(job_lock);
+        job_ready.wait(guard, [&] { return stopping || generation != seen; });
+        if (stopping) {return;}
+        seen = generation;
+        guard.unlock();
+
+        drain(self);
+
+        guard.lock();
+        if (--active == 0) {job_done.notify_all();}
+    }
+}
+
+bool WorkerPool::take(size_t self, size_t& task)
+{
+    //own queue first, in order
+    {
+        Queue& own = queues[self];
+        lock_guard<mutex> guard(own.lock);
+        if (!own.tasks.empty())
+        {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            own.ran++;
+            return true;
+        }
+    }
+
+    //then steal from the far end of someone else's
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+        Queue& victim = queues[(self + i) % queues.size()];
+        unique_lock<mutex> guard(victim.lock);
+        if (victim.tasks.empty()) {continue;}
+        task = victim.tasks.back();
+        victim.tasks.pop_back();
+        guard.unlock();
+
+        lock_guard<mutex> own_guard(queues[self].lock);
+        queues[self].ran++;
+        queues[self].stolen++;
+        return true;
+    }
+    return false;
+}
+
+void WorkerPool::drain(size_t self)
+{
+    size_t task;
+    while (take(self, task))
+    {
+        (*job)(task);
+    }
+}
+
+void WorkerPool::parallel_for(size_t count, const function<void(size_t)>& fn)
+{
+    if (count == 0) {return;}
+
+    //contiguous ranges per queue keep neighbouring chunks on one core
+    size_t q = queues.size();
+    for (size_t i = 0; i < q; i++)
+    {
+        lock_guard<mutex> guard(queues[i].lock);
+        queues[i].ran = 0;
+        queues[i].stolen = 0;
+        for (size_t t = i * count / q; t < (i + 1) * count / q; t++)
+        {
+            queues[i].tasks.push_back(t);
+        }
+    }
+
+    {
+        lock_guard<mutex> guard(job_lock);
+        job = &fn;
+        active = threads.size();
+        generation++;
+    }
+    job_ready.notify_all();
+
+    //the calling thread uses the last queue
+    drain(q - 1);
+
+    unique_lock<mutex> guard(job_lock);
+    job_done.wait(guard, [&] { return active == 0; });
+    job = nullptr;
+}
+
+vector<size_t> WorkerPool::last_ran() const
+{
+    vector<size_t> out;
+    for (const Queue& queue : queues) {out.push_back(queue.ran);}
+    return out;
+}
+
+size_t WorkerPool::last_stolen() const
+{
+    size_t total = 0;
+    for (const Queue& queue : queues) {total += queue.stolen;}
+    return total;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+//fixed set of worker threads that run parallel_for jobs. Each worker owns
+//a queue of task indices and works it from the front, in index order; when
+//it runs dry it steals from the back of the other queues, the tasks their
+//owners would reach last, so hot chunks do not leave cores idle the way a
+//static split would.
+class WorkerPool
+{
+private:
+    struct alignas(64) Queue
+    {
+        mutex lock;
+        deque<size_t> tasks;
+        size_t ran = 0;
+        size_t stolen = 0;
+    };
+
+    vector<thread> threads;
+    vector<Queue> queues;       //one per worker plus one for the calling thread
+
+    mutex job_lock;
+    condition_variable job_ready;
+    condition_variable job_done;
+    const function<void(size_t)>* job;
+    uint64_t generation;
+    size_t active;
+    bool stopping;
+
+    void worker_loop(size_t self);
+    bool take(size_t self, size_t& task);
+    void drain(size_t self);
+
+public:
+    //0 means one worker per hardware thread, the calling thread also works
+    explicit WorkerPool(size_t workers = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    size_t thread_count() const;
+
+    //runs fn(0) .. fn(count - 1) across the pool and returns when all are done
+    void parallel_for(size_t count, const function<void(size_t)>& fn);
+
+    //tasks each thread ran / stole during the last parallel_for
+    vector<size_t> last_ran() const;
+    size_t last_stolen() const;
+};